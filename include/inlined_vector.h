@@ -1,27 +1,186 @@
 // Customise the behaviour of inlined_vector by defining these before including it:
 // - #define BSP_INLINED_VECTOR_THROWS to get runtime_error
 // - #define BSP_INLINED_VECTOR_LOG_ERROR(message) to log errors
+// - #define BSP_INLINED_VECTOR_STATS to count spills and heap usage by default
+// - #define BSP_INLINED_VECTOR_PROFILE to profile sizes and print a capacity report at exit
 
 #ifndef BSP_INLINED_VECTOR_H
 #define BSP_INLINED_VECTOR_H
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <ostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 #include <type_traits>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 
-#ifdef BSP_INLINED_VECTOR_THROWS
-#include <stdexcept>
+#ifdef BSP_INLINED_VECTOR_PROFILE
+#include <iostream>
+#endif
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define BSP_INLINED_VECTOR_HAS_PMR
+#endif
+#if __has_include(<string_view>)
+#include <string_view>
+#define BSP_INLINED_VECTOR_HAS_STRING_VIEW
+#endif
 #endif
 
 namespace bsp {
+// Specialise this for types that can be moved with memcpy, after which the
+// source is discarded without running its destructor
+template<class T> struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
 namespace detail {
-	template<class T, int Capacity> class static_vector {
+	template<class T> using relocatable_tag = std::integral_constant<bool, is_trivially_relocatable<T>::value>;
+	template<class T> using copyable_tag = std::integral_constant<bool, std::is_trivially_copyable<T>::value>;
+
+	// Copy-constructs count elements into uninitialized storage
+	template<class T> inline void copy_construct_n(const T* source, std::size_t count, T* dest, std::true_type) {
+		if (count > 0) std::memcpy(static_cast<void*>(dest), static_cast<const void*>(source), count * sizeof(T));
+	}
+
+	template<class T> inline void copy_construct_n(const T* source, std::size_t count, T* dest, std::false_type) {
+		for (std::size_t i = 0; i < count; ++i) {
+			new (dest + i) T(source[i]);
+		}
+	}
+
+	template<class T> inline void copy_construct_n(const T* source, std::size_t count, T* dest) {
+		copy_construct_n(source, count, dest, copyable_tag<T>{});
+	}
+
+	// Value-initializes count elements, which zeroes trivial types
+	template<class T> inline void value_construct_n(std::size_t count, T* dest) {
+		for (std::size_t i = 0; i < count; ++i) {
+			new (dest + i) T();
+		}
+	}
+
+	// Default-initializes count elements, which leaves trivial types uninitialized
+	template<class T> inline void default_construct_n(std::size_t count, T* dest) {
+		for (std::size_t i = 0; i < count; ++i) {
+			new (dest + i) T;
+		}
+	}
+
+	template<class T> inline void fill_construct_n(std::size_t count, const T& value, T* dest) {
+		for (std::size_t i = 0; i < count; ++i) {
+			new (dest + i) T(value);
+		}
+	}
+
+	// Constructs count elements from a range into uninitialized storage
+	template<class T, class Iter> inline void construct_n(Iter first, std::size_t count, T* dest) {
+		for (std::size_t i = 0; i < count; ++i, ++first) {
+			new (dest + i) T(*first);
+		}
+	}
+
+	template<class T> inline void construct_n(const T* first, std::size_t count, T* dest) {
+		copy_construct_n(first, count, dest);
+	}
+
+	template<class T> inline void construct_n(T* first, std::size_t count, T* dest) {
+		copy_construct_n(static_cast<const T*>(first), count, dest);
+	}
+
+	template<class T> inline void construct_n(std::move_iterator<T*> first, std::size_t count, T* dest, std::true_type) {
+		copy_construct_n(static_cast<const T*>(first.base()), count, dest);
+	}
+
+	template<class T> inline void construct_n(std::move_iterator<T*> first, std::size_t count, T* dest, std::false_type) {
+		for (std::size_t i = 0; i < count; ++i) {
+			new (dest + i) T(std::move(first.base()[i]));
+		}
+	}
+
+	template<class T> inline void construct_n(std::move_iterator<T*> first, std::size_t count, T* dest) {
+		construct_n(first, count, dest, copyable_tag<T>{});
+	}
+
+	// Moves count elements into uninitialized storage and destroys the
+	// originals. The ranges must not overlap.
+	template<class T> inline void relocate_n(T* source, std::size_t count, T* dest, std::true_type) {
+		if (count > 0) std::memcpy(static_cast<void*>(dest), static_cast<const void*>(source), count * sizeof(T));
+	}
+
+	template<class T> inline void relocate_n(T* source, std::size_t count, T* dest, std::false_type) {
+		for (std::size_t i = 0; i < count; ++i) {
+			new (dest + i) T(std::move(source[i]));
+			source[i].~T();
+		}
+	}
+
+	template<class T> inline void relocate_n(T* source, std::size_t count, T* dest) {
+		relocate_n(source, count, dest, relocatable_tag<T>{});
+	}
+
+	// Moves [index, size) up to leave count uninitialized slots at index.
+	// There must be room for size + count elements.
+	template<class T> inline void insert_gap(T* data, std::size_t size, std::size_t index, std::size_t count, std::true_type) {
+		if (index < size) std::memmove(static_cast<void*>(data + index + count), static_cast<const void*>(data + index), (size - index) * sizeof(T));
+	}
+
+	template<class T> inline void insert_gap(T* data, std::size_t size, std::size_t index, std::size_t count, std::false_type) {
+		for (std::size_t i = size; i > index; --i) {
+			new (data + i - 1 + count) T(std::move(data[i - 1]));
+			data[i - 1].~T();
+		}
+	}
+
+	template<class T> inline void insert_gap(T* data, std::size_t size, std::size_t index, std::size_t count) {
+		insert_gap(data, size, index, count, relocatable_tag<T>{});
+	}
+
+	// Destroys [index, index + count) and moves the tail down over them
+	template<class T> inline void erase_n(T* data, std::size_t size, std::size_t index, std::size_t count, std::true_type) {
+		for (std::size_t i = index; i < index + count; ++i) {
+			data[i].~T();
+		}
+		std::memmove(static_cast<void*>(data + index), static_cast<const void*>(data + index + count), (size - index - count) * sizeof(T));
+	}
+
+	template<class T> inline void erase_n(T* data, std::size_t size, std::size_t index, std::size_t count, std::false_type) {
+		std::move(data + index + count, data + size, data + index);
+		for (std::size_t i = size - count; i < size; ++i) {
+			data[i].~T();
+		}
+	}
+
+	template<class T> inline void erase_n(T* data, std::size_t size, std::size_t index, std::size_t count) {
+		erase_n(data, size, index, count, relocatable_tag<T>{});
+	}
+
+	// The smallest unsigned type that can count up to Capacity
+	template<std::size_t Capacity> struct counter_type_for {
+		using type = typename std::conditional<Capacity <= UINT8_MAX, std::uint8_t,
+			typename std::conditional<Capacity <= UINT16_MAX, std::uint16_t,
+			typename std::conditional<Capacity <= UINT32_MAX, std::uint32_t,
+			std::uint64_t>::type>::type>::type;
+	};
+
+	// Alignment applies to the start of the buffer, elements are still packed
+	template<class T, int Capacity, std::size_t Alignment = alignof(T)> class static_vector {
 		static_assert(Capacity > 0, "Capacity is <= 0!");
+		static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two >= alignof(T)");
 
 	public:
 		using value_type = T;
@@ -30,45 +189,50 @@ namespace detail {
 		using reverse_iterator = std::reverse_iterator<iterator>;
 		using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 		using size_type = std::size_t;
+		using counter_type = typename counter_type_for<Capacity>::type;
 
 	public:
 		static_vector() = default;
 
-		static_vector(size_type count, const T& value = T()){
-			size_ = count;
-			for(size_type i = 0; i < size_; ++i) {
-				new (data_+i) T(value);
-			}
+		static_vector(size_type count){
+			if( count > max_size() ) throw std::bad_alloc{};
+			value_construct_n(count, begin());
+			size_ = static_cast<counter_type>(count);
+		}
+
+		static_vector(size_type count, const T& value){
+			if( count > max_size() ) throw std::bad_alloc{};
+			fill_construct_n(count, value, begin());
+			size_ = static_cast<counter_type>(count);
 		}
 
 		static_vector(const static_vector& other){
+			copy_construct_n(other.begin(), other.size_, begin());
 			size_ = other.size_;
-			for(size_type i = 0; i < size_; ++i) {
-				new (data_+i) T(other[i]);
-			}
 		}
 
+		// Moving relocates the elements and leaves other empty
 		static_vector(static_vector&& other){
+			relocate_n(other.begin(), other.size_, begin());
 			size_ = other.size_;
-			for(size_type i = 0; i < size_; ++i) {
-				new (data_+i) T(std::move(other[i]));
-			}
+			other.size_ = 0;
 		}
 
 		static_vector& operator=(const static_vector& other){
-			destroy_all();
-			size_ = other.size_;
-			for(size_type i = 0; i < size_; ++i) {
-				new (data_+i) T(other[i]);
+			if (this != &other) {
+				destroy_all();
+				copy_construct_n(other.begin(), other.size_, begin());
+				size_ = other.size_;
 			}
 			return *this;
 		}
 
 		static_vector& operator=(static_vector&& other){
-			destroy_all();
-			size_ = other.size_;
-			for(size_type i = 0; i < size_; ++i) {
-				new (data_+i) T(std::move(other[i]));
+			if (this != &other) {
+				destroy_all();
+				relocate_n(other.begin(), other.size_, begin());
+				size_ = other.size_;
+				other.size_ = 0;
 			}
 			return *this;
 		}
@@ -93,6 +257,44 @@ namespace detail {
 			new (data_+size_) T(std::forward<Args>(args)...);
 			++size_;
 		}
+
+		// The caller guarantees there is room
+		template<typename ...Args> void emplace_back_unchecked(Args&&... args) {
+			assert(size_ < max_size());
+			new (data_+size_) T(std::forward<Args>(args)...);
+			++size_;
+		}
+
+		void pop_back() {
+			assert(size_ > 0);
+			--size_;
+			destroy(data_+size_);
+		}
+
+		void clear() {
+			destroy_all();
+		}
+
+		template<typename ...Args> void emplace(size_type index, Args&&... args) {
+			if( size_ >= max_size() ) throw std::bad_alloc{};
+			insert_gap(begin(), size_, index, 1);
+			new (data_+index) T(std::forward<Args>(args)...);
+			++size_;
+		}
+
+		// Opens count slots at index and fills them with construct(first slot)
+		template<class Construct> void insert_with(size_type index, size_type count, Construct construct) {
+			if( size_ + count > max_size() ) throw std::bad_alloc{};
+			insert_gap(begin(), size_, index, count);
+			construct(begin() + index);
+			size_ = static_cast<counter_type>(size_ + count);
+		}
+
+		void erase(size_type index, size_type count = 1) {
+			assert(index + count <= size_);
+			erase_n(begin(), size_, index, count);
+			size_ = static_cast<counter_type>(size_ - count);
+		}
 	
 		T& operator[](size_type i){
 			return *launder(data_ + i);
@@ -119,8 +321,7 @@ namespace detail {
 
 		template <typename Container> void emplace_into(Container& container){
 			assert(container.size() == 0);
-			container.resize(size_);
-			std::move(begin(), end(), container.begin());
+			container.insert(container.end(), std::make_move_iterator(begin()), std::make_move_iterator(end()));
 			destroy_all();
 		}
 
@@ -130,14 +331,14 @@ namespace detail {
 			for(size_type i = 0; i < count; ++i) {
 				new (data_+i) T(value);
 			}
-			size_ = count;
+			size_ = static_cast<counter_type>(count);
 		}
 
 	protected:
 		using raw_type = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
 		
-		raw_type data_[Capacity];
-		size_type size_ = 0;
+		alignas(Alignment) raw_type data_[Capacity];
+		counter_type size_ = 0;
 
 	protected:
 		T* launder(raw_type* rt){
@@ -160,551 +361,3703 @@ namespace detail {
 		}
 	};
 
-	template <class, class Enable = void> struct is_iterator : std::false_type {};
-	template <typename T_> struct is_iterator<T_, typename std::enable_if<
-		std::is_base_of<std::input_iterator_tag, typename std::iterator_traits<T_>::iterator_category>::value ||
-		std::is_same<std::output_iterator_tag, typename std::iterator_traits<T_>::iterator_category>::value>::type>: std::true_type {};
-}
+	// Stores the allocator as an empty base when it is stateless
+	template<class Allocator, bool = std::is_empty<Allocator>::value> class allocator_holder : private Allocator {
+	public:
+		allocator_holder() = default;
+		allocator_holder(const Allocator& allocator) : Allocator(allocator) {}
+		allocator_holder(Allocator&& allocator) : Allocator(std::move(allocator)) {}
 
-// An inlined_vector is a fixed-size array with a vector-like interface
-// that can optionally grow beyond its capacity and become a std::vector.
-template<typename T, int Capacity, bool CanExpand = false> 
-class inlined_vector {
-	static_assert(Capacity > 0, "Capacity is <= 0!");
+	protected:
+		inline Allocator& alloc() { return *this; }
+		inline const Allocator& alloc() const { return *this; }
+	};
 
-public:
-	using value_type 			 = T;
-	using reference 			 = T&;
-	using const_reference 		 = const T&;
-	using iterator 				 = value_type*;
-	using const_iterator 		 = const value_type*;
-	using reverse_iterator 		 = std::reverse_iterator<iterator>;
-	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
-	using size_type = std::size_t;
+	template<class Allocator> class allocator_holder<Allocator, false> {
+	public:
+		allocator_holder() = default;
+		allocator_holder(const Allocator& allocator) : allocator_(allocator) {}
+		allocator_holder(Allocator&& allocator) : allocator_(std::move(allocator)) {}
 
-public:
-	inlined_vector() = default;
+	protected:
+		inline Allocator& alloc() { return allocator_; }
+		inline const Allocator& alloc() const { return allocator_; }
 
-	inlined_vector(size_type count, const T& value = T()):data_internal_(std::min(count, max_size()), value){
-		if (count > max_size()) {
-			size_ = max_size();
-			error("inlined_vector(count, value) got too many elements");
-		}
-		else {
-			size_ = count;
-		}		
-	}
+	private:
+		Allocator allocator_;
+	};
 
-	template<std::size_t Capacity_, bool CanExpand_>
-	inlined_vector(const inlined_vector<T, Capacity_, CanExpand_>& other)
-		: inlined_vector(other.begin(), other.size()) {}
+	// Stores a function object such as a comparator as an empty base when it
+	// is stateless
+	template<class T, bool = std::is_empty<T>::value> class ebo_holder : private T {
+	public:
+		ebo_holder() = default;
+		ebo_holder(const T& value) : T(value) {}
+		ebo_holder(T&& value) : T(std::move(value)) {}
 
-	template<std::size_t Capacity_, bool CanExpand_>
-	inlined_vector(inlined_vector<T, Capacity_, CanExpand_>&& other)
-		: inlined_vector(other.begin(), other.size()) {}
+	protected:
+		inline T& get() { return *this; }
+		inline const T& get() const { return *this; }
+	};
 
-	template<class Container>
-	inlined_vector(const Container& els) : inlined_vector(els.begin(), els.size()) {}
+	template<class T> class ebo_holder<T, false> {
+	public:
+		ebo_holder() = default;
+		ebo_holder(const T& value) : value_(value) {}
+		ebo_holder(T&& value) : value_(std::move(value)) {}
 
-	inlined_vector(std::initializer_list<T> els) : inlined_vector(els.begin(), els.size()) {}
+	protected:
+		inline T& get() { return value_; }
+		inline const T& get() const { return value_; }
 
-	constexpr static inline size_type max_size() { return Capacity; }
+	private:
+		T value_;
+	};
 
-	inline virtual bool can_expand() const { return false; }
+	template<std::size_t Alignment> struct alignas(Alignment) aligned_block {
+		unsigned char bytes[Alignment];
+	};
 
-	inline void clear() { size_ = 0; }
+	// Allocates over-aligned blocks with the global operator new, as
+	// std::allocator only honours extended alignment from C++17
+	template<class Block> struct aligned_new_allocator {
+		using value_type = Block;
+
+		aligned_new_allocator() = default;
+		template<class U> aligned_new_allocator(const std::allocator<U>&) {}
+
+		Block* allocate(std::size_t count) {
+#ifdef __cpp_aligned_new
+			return static_cast<Block*>(::operator new(count * sizeof(Block), std::align_val_t(alignof(Block))));
+#else
+			// Over-allocates and keeps the original pointer just before the block
+			void* raw = ::operator new(count * sizeof(Block) + alignof(Block) + sizeof(void*));
+			std::uintptr_t address = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+			address = (address + alignof(Block) - 1) & ~std::uintptr_t(alignof(Block) - 1);
+			reinterpret_cast<void**>(address)[-1] = raw;
+			return reinterpret_cast<Block*>(address);
+#endif
+		}
 
-	inline size_type size() const { return size_; }
+		void deallocate(Block* data, std::size_t) {
+#ifdef __cpp_aligned_new
+			::operator delete(data, std::align_val_t(alignof(Block)));
+#else
+			::operator delete(reinterpret_cast<void**>(data)[-1]);
+#endif
+		}
+	};
 
-	inline bool empty() const { return size_ == 0; }
+	// Rebinds Allocator to Alignment-sized blocks
+	template<class Allocator, std::size_t Alignment> struct block_allocator_for {
+		using type = typename std::allocator_traits<Allocator>::template rebind_alloc<aligned_block<Alignment>>;
+	};
 
-	inline bool full() const { return size_ >= max_size(); }
+	template<class T, std::size_t Alignment> struct block_allocator_for<std::allocator<T>, Alignment> {
+		using type = aligned_new_allocator<aligned_block<Alignment>>;
+	};
 
-	inline virtual bool expanded() const { return false; }
+	// A size with a flag in its high bit. Assigning a size keeps the flag.
+	template<class SizeType> class tagged_size {
+		static_assert(std::is_unsigned<SizeType>::value, "SizeType must be unsigned");
+		static constexpr SizeType flag = SizeType(1) << (sizeof(SizeType) * 8 - 1);
 
-	template <typename U>
-	inline void push_back(U&& value) {
-		if (size_ >= max_size()) {
-			error("inlined_vector::push_back exceeded Capacity");
-		}
-		else {
-			data_internal_.push_back(std::forward<U>(value));
-			size_++;
+	public:
+		tagged_size() = default;
+		tagged_size(const tagged_size&) = delete;
+
+		inline operator SizeType() const { return value_ & ~flag; }
+
+		inline tagged_size& operator=(SizeType size) {
+			assert((size & flag) == 0);
+			value_ = (value_ & flag) | size;
+			return *this;
 		}
+
+		inline tagged_size& operator=(const tagged_size& other) { return *this = SizeType(other); }
+
+		// The size is in the low bits so arithmetic leaves the flag alone
+		inline tagged_size& operator++() { ++value_; return *this; }
+		inline tagged_size& operator--() { --value_; return *this; }
+		inline SizeType operator++(int) { SizeType size = *this; ++value_; return size; }
+		inline SizeType operator--(int) { SizeType size = *this; --value_; return size; }
+		inline tagged_size& operator+=(SizeType count) { value_ += count; return *this; }
+		inline tagged_size& operator-=(SizeType count) { value_ -= count; return *this; }
+
+		inline bool spilled() const { return (value_ & flag) != 0; }
+		inline void set_spilled(bool spilled) { value_ = spilled ? (value_ | flag) : (value_ & ~flag); }
+
+		inline void swap(tagged_size& other) { std::swap(value_, other.value_); }
+
+	private:
+		SizeType value_ = 0;
+	};
+
+	// The inline buffer is dead once the elements spill, so the heap
+	// block's pointer and capacity share its storage.
+	template<class T, int Capacity, std::size_t Alignment> union expandable_storage {
+		using raw_type = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+		struct heap_type {
+			T* data;
+			std::size_t capacity;
+		};
+
+		alignas(Alignment) raw_type inline_[Capacity];
+		heap_type heap;
+	};
+
+	// Remembers the largest size a vector has had, for capacity_profiler.
+	// Sizes only need noting just before they drop.
+	template<bool Enabled> class high_water_mark {
+	protected:
+		void note_size(std::size_t) {}
+		std::size_t high_water(std::size_t size) const { return size; }
+	};
+
+	template<> class high_water_mark<true> {
+	protected:
+		void note_size(std::size_t size) { high_water_ = std::max(high_water_, size); }
+		std::size_t high_water(std::size_t size) const { return std::max(high_water_, size); }
+
+	private:
+		std::size_t high_water_ = 0;
+	};
+
+	// The expandable vector's members. By default the size follows the
+	// buffer. With a CacheLine the size comes first and the whole vector
+	// is aligned to the line, so the size and first element share a line.
+	// Any high water mark is a base, so it joins that header too.
+	template<class Storage, std::size_t CacheLine, bool TrackHighWater, bool HeaderFirst = (CacheLine > 0)>
+	struct expandable_layout : high_water_mark<TrackHighWater> {
+		Storage storage_;
+		// Not compacted as the size can exceed Capacity once spilled, instead
+		// the high bit says whether it has, keeping the header to one word
+		tagged_size<std::size_t> size_;
+	};
+
+	template<class Storage, std::size_t CacheLine, bool TrackHighWater>
+	struct alignas(CacheLine) expandable_layout<Storage, CacheLine, TrackHighWater, true> : high_water_mark<TrackHighWater> {
+		tagged_size<std::size_t> size_;
+		Storage storage_;
+	};
+
+	// Logs and throws as configured by the macros at the top of this file
+	inline void report_error(const char* message) {
+#ifdef BSP_INLINED_VECTOR_LOG_ERROR
+		BSP_INLINED_VECTOR_LOG_ERROR(message);
+#endif
+
+#ifdef BSP_INLINED_VECTOR_THROWS
+		throw std::runtime_error(message);
+#else
+		(void) message;
+#endif
 	}
 
-	template<class... Args> inline void emplace_back(Args&&... args) {
-		if (size_ >= max_size()) {
-			error("inlined_vector::emplace_back exceeded Capacity");
-		}
-		else {
-			data_internal_.emplace_back(std::forward<Args>(args)...);
-			size_++;
+	// value must be > 0
+	inline int floor_log2(std::size_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+		return static_cast<int>(sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(value);
+#else
+		int result = 0;
+		while (value >>= 1) {
+			++result;
 		}
+		return result;
+#endif
 	}
 
-	template<class Container> void extend(const Container& other) {
-		for (auto v : other) {
-			push_back(std::move(v));
+	inline int popcount(std::uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_popcountll(value);
+#else
+		int result = 0;
+		for (; value; value &= value - 1) {
+			++result;
 		}
+		return result;
+#endif
 	}
 
-	void extend(std::initializer_list<T> other) {
-		for (auto v : other) {
-			push_back(std::move(v));
+	// value must be > 0
+	inline int count_trailing_zeros(std::uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(value);
+#else
+		int result = 0;
+		for (; !(value & 1); value >>= 1) {
+			++result;
 		}
+		return result;
+#endif
 	}
 
-	inline virtual void pop_back() {
-		if (!empty()) size_--;
-	}
+	template <class, class Enable = void> struct is_iterator : std::false_type {};
+	template <typename T_> struct is_iterator<T_, typename std::enable_if<
+		std::is_base_of<std::input_iterator_tag, typename std::iterator_traits<T_>::iterator_category>::value ||
+		std::is_same<std::output_iterator_tag, typename std::iterator_traits<T_>::iterator_category>::value>::type>: std::true_type {};
 
-	inline const_reference back() const {
-		if (!empty()) {
-			return *std::prev(end());
+	// The interface shared by both inlined_vector specializations.
+	// Storage is dispatched statically: Derived provides begin(), size(),
+	// clear(), emplace_back(), erase_at(index, count) and
+	// insert_with(index, count, construct), which makes room for count
+	// elements at index in one step and calls construct(T* first) to fill them.
+	template<class Derived, class T, int Capacity> class inlined_vector_base {
+	public:
+		using value_type 			 = T;
+		using reference 			 = T&;
+		using const_reference 		 = const T&;
+		using iterator 				 = value_type*;
+		using const_iterator 		 = const value_type*;
+		using reverse_iterator 		 = std::reverse_iterator<iterator>;
+		using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+		using size_type = std::size_t;
+
+	public:
+		constexpr static inline size_type max_size() { return Capacity; }
+
+		inline bool empty() const { return derived().size() == 0; }
+
+		inline bool full() const { return derived().size() >= max_size(); }
+
+		inline const_reference back() const {
+			if (!empty()) {
+				return *std::prev(end());
+			}
+			return *derived().begin();
 		}
-		return data_internal_[0];
-	}
 
-	inline reference back() { return const_cast<reference>(static_cast<const inlined_vector*>(this)->back()); }
+		inline reference back() { return const_cast<reference>(static_cast<const inlined_vector_base*>(this)->back()); }
 
-	inline const_reference front() const {
-		if (!empty()) {
-			return *begin();
+		inline const_reference front() const {
+			return *derived().begin();
 		}
-		return data_internal_[0];
-	}
 
-	inline reference front() { return const_cast<reference>(static_cast<const inlined_vector*>(this)->front()); }
+		inline reference front() { return const_cast<reference>(static_cast<const inlined_vector_base*>(this)->front()); }
 
-	inline reference operator[](size_type i) { return element(i); }
+		inline reference operator[](size_type i) { return element(i); }
 
-	inline const_reference operator[](size_type i) const { return element(i); }
+		inline const_reference operator[](size_type i) const { return element(i); }
 
-	inline const_reference at(size_type i) const {
-		if (i >= 0 && i < size_) {
-			return element(i);
-		}
-		else {
-			throw std::out_of_range("inlined_vector::at");
+		inline const_reference at(size_type i) const {
+			if (i < derived().size()) {
+				return element(i);
+			}
+			else {
+				throw std::out_of_range("inlined_vector::at");
+			}
 		}
-	}
 
-	inline reference at(size_type i) {
-		return const_cast<reference>(static_cast<const inlined_vector*>(this)->at(i));
-	}
+		inline reference at(size_type i) {
+			return const_cast<reference>(static_cast<const inlined_vector_base*>(this)->at(i));
+		}
 
-	virtual iterator begin() { return data_internal_.begin(); }
-	iterator end() { return begin() + size_; }
+		iterator end() { return derived().begin() + derived().size(); }
+		const_iterator end() const { return derived().begin() + derived().size(); }
 
-	const_iterator cbegin() const { return begin(); }
-	const_iterator cend() const { return end(); }
+		const_iterator cbegin() const { return derived().begin(); }
+		const_iterator cend() const { return end(); }
 
-	virtual const_iterator begin() const { return data_internal_.begin(); }
-	const_iterator end() const { return begin() + size_; }
+		reverse_iterator rbegin() { return reverse_iterator(end()); }
+		reverse_iterator rend() { return reverse_iterator(derived().begin()); }
 
-	reverse_iterator rbegin() { return rend() - size_; }
-	virtual reverse_iterator rend() { return data_internal_.rend(); }
+		const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+		const_reverse_iterator rend() const { return const_reverse_iterator(derived().begin()); }
 
-	const_reverse_iterator rbegin() const { return rend() - size_; }
-	virtual const_reverse_iterator rend() const { return data_internal_.rend(); }
+		inline bool contains(const_reference value) const {
+			auto begin_ = derived().begin();
+			auto end_ = end();
+			return std::find(begin_, end_, value) != end_;
+		}
 
-	iterator erase(const_iterator it) {
-		validate_iterator(it);
+		iterator erase(const_iterator it) {
+			validate_iterator(it);
 
-		if (it == end() || empty()) {
-			error("inlined_vector::erase it == end or container is empty");
-			return end();
+			if (it == end() || empty()) {
+				error("inlined_vector::erase it == end or container is empty");
+				return end();
+			}
+			return erase(it, std::next(it));
 		}
 
-		size_type i = iterator_index(it);
-		if (i == size_) {
-			error("inlined_vector::insert invalid iterator");
-			return end();
-		}
-		for (size_type j = i; j < size_ - 1; j++) {
-			element(j) = std::move(element(j + 1));
-		}
-		size_--;
-		return begin() + i;
-	}
+		// Moves the tail down once and destroys the range in bulk
+		iterator erase(const_iterator first, const_iterator last) {
+			validate_iterator(first);
+			validate_iterator(last);
 
-	iterator insert(iterator it, const_reference value) {
-		validate_iterator(it);
+			if (first > last) {
+				error("inlined_vector::erase invalid range");
+				return end();
+			}
+			size_type i = iterator_index(first);
+			derived().erase_at(i, static_cast<size_type>(last - first));
+			return derived().begin() + i;
+		}
 
-		if (full()) {
-			error("inlined_vector::insert exceeded Capacity");
-			return end();
+		iterator insert(const_iterator it, const_reference value) {
+			return emplace(it, value);
 		}
 
-		if (it == end()) {
-			push_back(value);
-			return std::prev(end(), 1);
+		iterator insert(const_iterator it, value_type&& value) {
+			return emplace(it, std::move(value));
 		}
-		else {
-			// Insert at i and push everything back
+
+		template<class... Args> iterator emplace(const_iterator it, Args&&... args) {
+			validate_iterator(it);
 			size_type i = iterator_index(it);
-			if (i == size_) {
-				error("inlined_vector::insert invalid iterator");
+			// args may refer to an element that is about to move
+			T value(std::forward<Args>(args)...);
+			if (!derived().insert_with(i, 1, [&](T* dest) { new (dest) T(std::move(value)); })) {
 				return end();
 			}
-			for (size_type j = size_; j > i; j--) {
-				element(j) = std::move(element(j - 1));
+			return derived().begin() + i;
+		}
+
+		iterator insert(const_iterator it, size_type count, const_reference value) {
+			validate_iterator(it);
+			size_type i = iterator_index(it);
+			T copy(value);
+			if (!derived().insert_with(i, count, [&](T* dest) {
+				for (size_type j = 0; j < count; ++j) {
+					new (dest + j) T(copy);
+				}
+			})) {
+				return end();
 			}
-			element(i) = value;
-			size_++;
-			return std::next(begin(), i);
+			return derived().begin() + i;
 		}
-	}
 
-	inline bool contains(const_reference value) const {
-		auto begin_ = begin();
-		auto end_ = end();
-		return std::find(begin_, end_, value) != end_;
-	}
+		template<class Iter, typename = typename std::enable_if<is_iterator<Iter>::value>::type>
+		iterator insert(const_iterator it, Iter first, Iter last) {
+			validate_iterator(it);
+			size_type i = iterator_index(it);
+			return insert_range(i, first, last, typename std::iterator_traits<Iter>::iterator_category{});
+		}
 
-protected:
-	using array_type = detail::static_vector<T, Capacity>;
+		iterator insert(const_iterator it, std::initializer_list<T> els) {
+			return insert(it, els.begin(), els.end());
+		}
 
-	array_type data_internal_;
-	size_type size_ = 0;
+		template<class Iter, typename = typename std::enable_if<is_iterator<Iter>::value>::type>
+		void append(Iter first, Iter last) {
+			insert_range(derived().size(), first, last, typename std::iterator_traits<Iter>::iterator_category{});
+		}
 
-protected:
-	// Helper constructor
-	template<typename Iter, typename = typename std::enable_if<detail::is_iterator<Iter>::value>::type> 
-	inlined_vector(Iter begin_, std::size_t size) {		
-		if (size > max_size()) {
-			error("inlined_vector() too many elements");
-			size_ = max_size();
+		template<class Container> void extend(const Container& other) {
+			append(std::begin(other), std::end(other));
 		}
-		else {
-			size_ = size;
+
+		void extend(std::initializer_list<T> other) {
+			append(other.begin(), other.end());
 		}
 
-		auto end_ = std::next(begin_, size_);
-		for (auto it = begin_; it != end_; ++it){
-			data_internal_.emplace_back(std::move(*it));
+		template<class Iter, typename = typename std::enable_if<is_iterator<Iter>::value>::type>
+		void assign(Iter first, Iter last) {
+			derived().clear();
+			append(first, last);
 		}
-	}
 
-	// Helper constructor for sub-class
-	inlined_vector(array_type&& array, std::size_t size)
-		: data_internal_(std::move(array)), size_(size) {}
+		void assign(size_type count, const_reference value) {
+			T copy(value);
+			derived().clear();
+			insert(end(), count, copy);
+		}
 
-	inline reference element(size_type index) { return *std::next(begin(), index); }
+		void assign(std::initializer_list<T> els) {
+			assign(els.begin(), els.end());
+		}
 
-	inline const_reference element(size_type index) const { return *std::next(begin(), index); }
+		// Value-initializes any new elements
+		void resize(size_type count) {
+			resize_with(count, [](T* dest, size_type n) { value_construct_n(n, dest); });
+		}
+
+		void resize(size_type count, const_reference value) {
+			if (count <= derived().size()) {
+				resize_with(count, [](T*, size_type) {});
+			}
+			else {
+				// value may be an element that is about to move
+				T copy(value);
+				resize_with(count, [&](T* dest, size_type n) { fill_construct_n(n, copy, dest); });
+			}
+		}
+
+		// Default-initializes any new elements, leaving trivial types
+		// uninitialized for buffers that are about to be overwritten
+		void resize_default_init(size_type count) {
+			resize_with(count, [](T* dest, size_type n) { default_construct_n(n, dest); });
+		}
+
+	protected:
+		template<class Construct> void resize_with(size_type count, Construct construct) {
+			const size_type size = derived().size();
+			if (count < size) {
+				derived().erase_at(count, size - count);
+			}
+			else if (count > size) {
+				derived().insert_with(size, count - size, [&](T* dest) { construct(dest, count - size); });
+			}
+		}
+
+		inline Derived& derived() { return static_cast<Derived&>(*this); }
+		inline const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+		inline reference element(size_type index) { return derived().begin()[index]; }
+
+		inline const_reference element(size_type index) const { return derived().begin()[index]; }
+
+		inline size_type iterator_index(const_iterator it) const {
+			return static_cast<size_type>(it - derived().begin());
+		}
+
+		// Single pass ranges are appended one at a time and rotated into place
+		template<class Iter> iterator insert_range(size_type index, Iter first, Iter last, std::input_iterator_tag) {
+			size_type old_size = derived().size();
+			for (; first != last; ++first) {
+				derived().emplace_back(*first);
+			}
+			std::rotate(derived().begin() + index, derived().begin() + old_size, end());
+			return derived().begin() + index;
+		}
+
+		template<class Iter> iterator insert_range(size_type index, Iter first, Iter last, std::forward_iterator_tag) {
+			size_type count = static_cast<size_type>(std::distance(first, last));
+			if (!derived().insert_with(index, count, [&](T* dest) { construct_n(first, count, dest); })) {
+				return end();
+			}
+			return derived().begin() + index;
+		}
+
+		inline void validate_iterator(const_iterator it) const {
+#ifndef NDEBUG
+			if (it < derived().begin() || it > end()) {
+				error("inlined_vector::validate_iterator invalid iterator");
+			}
+#else
+			(void) it;
+#endif
+		}
+
+		void error(const char* message) const {
+			report_error(message);
+		}
+	};
+}
+
+// Controls how an expandable inlined_vector manages its heap storage.
+// Derive from it to override individual members.
+struct inlined_vector_policy {
+	// The heap capacity to allocate when a vector holding capacity elements
+	// (inline or on the heap) needs room for required elements
+	static std::size_t grow(std::size_t capacity, std::size_t required) {
+		return std::max(required, 2 * capacity);
+	}
+
+	// Whether shrink_to_fit moves size elements from the heap back into an
+	// inline buffer of capacity elements
+	static bool return_inline(std::size_t size, std::size_t capacity) {
+		return size <= capacity;
+	}
+
+	// Instrumentation hooks, called with the vector's type. They do nothing
+	// here, so an uninstrumented vector compiles to the same code.
+	template<class Vector> static void on_spill(std::size_t /* moved */) {}
+	template<class Vector> static void on_shrink() {}
+	template<class Vector> static void on_allocate(std::size_t /* bytes */) {}
+	template<class Vector> static void on_deallocate(std::size_t /* bytes */) {}
+
+	// Whether vectors track their largest size for on_destroy
+	static constexpr bool track_high_water = false;
+
+	// When non-zero, vectors put their size first and align to this line size
+	static constexpr std::size_t cache_line = 0;
+	template<class Vector> static void on_destroy(std::size_t /* size */, std::size_t /* max_size */) {}
+
+	// Whether copies of a spilled vector share its heap storage
+	static constexpr bool copy_on_write = false;
+};
+
+// Grows the heap storage by a factor of Numerator / Denominator
+template<std::size_t Numerator, std::size_t Denominator = 1, class Base = inlined_vector_policy>
+struct geometric_growth : Base {
+	static_assert(Numerator > Denominator, "The growth factor must be > 1");
+
+	static std::size_t grow(std::size_t capacity, std::size_t required) {
+		return std::max(required, capacity * Numerator / Denominator);
+	}
+};
+
+// Only returns inline once the size drops to Numerator / Denominator of the
+// inline capacity, so a vector hovering around it doesn't keep moving
+template<std::size_t Numerator, std::size_t Denominator, class Base = inlined_vector_policy>
+struct shrink_hysteresis : Base {
+	static_assert(Numerator <= Denominator, "The shrink threshold must be <= 1");
+
+	static bool return_inline(std::size_t size, std::size_t capacity) {
+		return size <= capacity * Numerator / Denominator;
+	}
+};
+
+// Puts the size before the inline buffer and aligns the vector to LineSize
+template<std::size_t LineSize = 64, class Base = inlined_vector_policy> struct cache_line_layout : Base {
+	static_assert(LineSize > 0 && (LineSize & (LineSize - 1)) == 0, "LineSize must be a power of two");
+	static constexpr std::size_t cache_line = LineSize;
+};
+
+// Copies of a spilled vector share its heap storage, which is reference
+// counted atomically so the copies can live on different threads. The first
+// non-const access to a shared vector (including non-const begin() and
+// operator[]) detaches it with a copy of the elements. Inline vectors are
+// copied as usual.
+template<class Base = inlined_vector_policy> struct copy_on_write_policy : Base {
+	static constexpr bool copy_on_write = true;
+};
+
+// The largest Capacity for which an expandable vector of T with
+// cache_line_layout fits in Lines cache lines. The header is the size, plus
+// the high water mark for policies that track it.
+template<typename T, std::size_t Lines, std::size_t LineSize = 64, std::size_t HeaderWords = 1> struct cache_line_capacity {
+	static constexpr std::size_t header = (HeaderWords * sizeof(std::size_t) + alignof(T) - 1) / alignof(T) * alignof(T);
+	static constexpr int value = static_cast<int>((Lines * LineSize - header) / sizeof(T));
+};
+
+// A snapshot of the counters kept by counting_policy
+struct inlined_vector_stats {
+	const char* name = "total"; // The vector type, as given by typeid
+	std::size_t spills = 0;
+	std::size_t shrinks = 0;
+	std::size_t heap_bytes = 0;
+	std::size_t peak_heap_bytes = 0;
+	std::size_t elements_moved = 0; // Relocated from inline storage when spilling
+
+	// Across all instrumented instantiations
+	static inlined_vector_stats total();
+
+	// For one instrumented instantiation
+	template<class Vector> static inlined_vector_stats of();
+
+	// For each instrumented instantiation that has been used
+	static std::vector<inlined_vector_stats> instantiations();
+};
+
+namespace detail {
+	class stats_counters {
+	public:
+		explicit stats_counters(const char* name, bool listed = true) : name_(name) {
+			if (listed) {
+				std::atomic<stats_counters*>& head = registry();
+				next_ = head.load(std::memory_order_relaxed);
+				while (!head.compare_exchange_weak(next_, this, std::memory_order_release, std::memory_order_relaxed)) {}
+			}
+		}
+
+		void spill(std::size_t moved) {
+			spills_.fetch_add(1, std::memory_order_relaxed);
+			moved_.fetch_add(moved, std::memory_order_relaxed);
+		}
+
+		void shrink() {
+			shrinks_.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void allocate(std::size_t bytes) {
+			std::size_t held = heap_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+			std::size_t peak = peak_.load(std::memory_order_relaxed);
+			while (held > peak && !peak_.compare_exchange_weak(peak, held, std::memory_order_relaxed)) {}
+		}
+
+		void deallocate(std::size_t bytes) {
+			heap_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+		}
+
+		inlined_vector_stats snapshot() const {
+			inlined_vector_stats stats;
+			stats.name = name_;
+			stats.spills = spills_.load(std::memory_order_relaxed);
+			stats.shrinks = shrinks_.load(std::memory_order_relaxed);
+			stats.heap_bytes = heap_bytes_.load(std::memory_order_relaxed);
+			stats.peak_heap_bytes = peak_.load(std::memory_order_relaxed);
+			stats.elements_moved = moved_.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+		const stats_counters* next() const { return next_; }
+
+		static std::atomic<stats_counters*>& registry() {
+			static std::atomic<stats_counters*> head { nullptr };
+			return head;
+		}
+
+		static stats_counters& total() {
+			static stats_counters counters ("total", false);
+			return counters;
+		}
+
+		template<class Vector> static stats_counters& of() {
+			static stats_counters counters (typeid(Vector).name());
+			return counters;
+		}
+
+	private:
+		const char* name_;
+		stats_counters* next_ = nullptr;
+		std::atomic<std::size_t> spills_ { 0 };
+		std::atomic<std::size_t> shrinks_ { 0 };
+		std::atomic<std::size_t> heap_bytes_ { 0 };
+		std::atomic<std::size_t> peak_ { 0 };
+		std::atomic<std::size_t> moved_ { 0 };
+	};
+}
+
+inline inlined_vector_stats inlined_vector_stats::total() {
+	return detail::stats_counters::total().snapshot();
+}
+
+template<class Vector> inline inlined_vector_stats inlined_vector_stats::of() {
+	return detail::stats_counters::of<Vector>().snapshot();
+}
+
+inline std::vector<inlined_vector_stats> inlined_vector_stats::instantiations() {
+	std::vector<inlined_vector_stats> result;
+	for (const detail::stats_counters* counters = detail::stats_counters::registry().load(std::memory_order_acquire); counters; counters = counters->next()) {
+		result.push_back(counters->snapshot());
+	}
+	return result;
+}
+
+// Counts spills, shrinks and heap usage per instantiation and in total,
+// read them back with inlined_vector_stats. Costs a few relaxed atomic
+// operations on each heap allocation, nothing on the inline paths.
+template<class Base = inlined_vector_policy> struct counting_policy : Base {
+	template<class Vector> static void on_spill(std::size_t moved) {
+		detail::stats_counters::of<Vector>().spill(moved);
+		detail::stats_counters::total().spill(moved);
+	}
+
+	template<class Vector> static void on_shrink() {
+		detail::stats_counters::of<Vector>().shrink();
+		detail::stats_counters::total().shrink();
+	}
+
+	template<class Vector> static void on_allocate(std::size_t bytes) {
+		detail::stats_counters::of<Vector>().allocate(bytes);
+		detail::stats_counters::total().allocate(bytes);
+	}
+
+	template<class Vector> static void on_deallocate(std::size_t bytes) {
+		detail::stats_counters::of<Vector>().deallocate(bytes);
+		detail::stats_counters::total().deallocate(bytes);
+	}
+};
+
+namespace detail {
+	// Counts vector sizes exactly below 64 and in power-of-two buckets above
+	class size_histogram {
+	public:
+		static constexpr int exact = 64;
+		static constexpr int buckets = exact + 64;
+
+		void add(std::size_t size) {
+			counts_[bucket(size)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// Adds a thread's batch of bucket counts
+		void merge(const std::uint32_t* counts) {
+			for (int b = 0; b < buckets; ++b) {
+				if (counts[b] != 0) {
+					counts_[b].fetch_add(counts[b], std::memory_order_relaxed);
+				}
+			}
+		}
+
+		std::size_t count(int b) const { return counts_[b].load(std::memory_order_relaxed); }
+
+		// The largest size that falls in bucket b
+		static std::size_t upper_bound(int b) {
+			return b < exact ? std::size_t(b) : (std::size_t(2) << (b - exact + 6)) - 1;
+		}
+
+		static int bucket(std::size_t size) {
+			return size < std::size_t(exact) ? static_cast<int>(size) : exact + floor_log2(size) - 6;
+		}
+
+		// The smallest size covering the given fraction of samples
+		std::size_t quantile(double fraction) const {
+			std::size_t total = 0;
+			for (int b = 0; b < buckets; ++b) {
+				total += count(b);
+			}
+			std::size_t seen = 0;
+			for (int b = 0; b < buckets; ++b) {
+				seen += count(b);
+				if (seen > 0 && static_cast<double>(seen) >= fraction * static_cast<double>(total)) {
+					return upper_bound(b);
+				}
+			}
+			return 0;
+		}
+
+	private:
+		std::atomic<std::size_t> counts_[buckets] = {};
+	};
+
+	class capacity_profile {
+	public:
+		capacity_profile(const char* name, std::size_t capacity, std::size_t element_size)
+			: name_(name), capacity_(capacity), element_size_(element_size) {
+			std::atomic<capacity_profile*>& head = registry();
+			next_ = head.load(std::memory_order_relaxed);
+			while (!head.compare_exchange_weak(next_, this, std::memory_order_release, std::memory_order_relaxed)) {}
+#ifdef BSP_INLINED_VECTOR_PROFILE
+			static report_at_exit reporter;
+#endif
+		}
+
+		void record(std::size_t size, std::size_t max_size) {
+			samples_.fetch_add(1, std::memory_order_relaxed);
+			if (max_size > capacity_) {
+				spills_.fetch_add(1, std::memory_order_relaxed);
+			}
+			final_sizes_.add(size);
+			max_sizes_.add(max_size);
+		}
+
+		void merge(std::size_t samples, std::size_t spills, const std::uint32_t* final_sizes, const std::uint32_t* max_sizes) {
+			samples_.fetch_add(samples, std::memory_order_relaxed);
+			spills_.fetch_add(spills, std::memory_order_relaxed);
+			final_sizes_.merge(final_sizes);
+			max_sizes_.merge(max_sizes);
+		}
+
+		std::size_t capacity() const { return capacity_; }
+
+		// Recommends the smallest capacity that would have held the given
+		// fraction of vectors at their largest
+		void report(std::ostream& out, double quantile) const {
+			const std::size_t samples = samples_.load(std::memory_order_relaxed);
+			if (samples == 0) {
+				return;
+			}
+			const std::size_t recommended = std::max<std::size_t>(1, max_sizes_.quantile(quantile));
+			out << name_ << "\n";
+			out << "  vectors: " << samples << ", capacity: " << capacity_
+				<< ", spilled: " << 100.0 * static_cast<double>(spills_.load(std::memory_order_relaxed)) / static_cast<double>(samples) << "%\n";
+			out << "  size at destruction p50/p" << 100.0 * quantile << ": " << final_sizes_.quantile(0.5) << "/" << final_sizes_.quantile(quantile)
+				<< ", max size p50/p" << 100.0 * quantile << ": " << max_sizes_.quantile(0.5) << "/" << max_sizes_.quantile(quantile) << "\n";
+			const std::size_t now = capacity_ * element_size_, then = recommended * element_size_;
+			out << "  recommended capacity: " << recommended << ", inline bytes per vector: " << now << " -> " << then;
+			if (then < now) {
+				out << ", saving " << (now - then) * samples << " bytes over these vectors";
+			}
+			out << "\n";
+		}
+
+		const capacity_profile* next() const { return next_; }
+
+		static std::atomic<capacity_profile*>& registry() {
+			static std::atomic<capacity_profile*> head { nullptr };
+			return head;
+		}
+
+		template<class Key, class Vector> static capacity_profile& of() {
+			static capacity_profile profile (typeid(Key).name(), Vector::inline_capacity, sizeof(typename Vector::value_type));
+			return profile;
+		}
+
+	private:
+		const char* name_;
+		std::size_t capacity_;
+		std::size_t element_size_;
+		capacity_profile* next_ = nullptr;
+		std::atomic<std::size_t> samples_ { 0 };
+		std::atomic<std::size_t> spills_ { 0 };
+		size_histogram final_sizes_;
+		size_histogram max_sizes_;
+
+#ifdef BSP_INLINED_VECTOR_PROFILE
+		struct report_at_exit {
+			~report_at_exit();
+		};
+#endif
+	};
+
+	// Profiles registered after the reporter are still readable at exit
+	static_assert(std::is_trivially_destructible<capacity_profile>::value, "capacity_profile must outlive the report");
+
+	// A thread's samples for one capacity_profile, merged into the shared
+	// counters every batch_size samples and when the thread exits, so
+	// destroying a vector doesn't touch cache lines shared between threads
+	class local_profile {
+	public:
+		static constexpr std::size_t batch_size = 256;
+
+		// Null once this thread has started exiting, samples then go
+		// straight to the shared profile
+		template<class Key, class Vector> static local_profile* of() {
+			static thread_local local_profile* local = nullptr;
+			static thread_local bool exited = false;
+			if (!local && !exited) {
+				static thread_local local_profile owner (capacity_profile::of<Key, Vector>(), local, exited);
+			}
+			return local;
+		}
+
+		local_profile(capacity_profile& profile, local_profile*& self, bool& exited)
+			: profile_(profile), self_(self), exited_(exited), next_(thread_head()) {
+			thread_head() = this;
+			self = this;
+		}
+
+		local_profile(const local_profile&) = delete;
+		local_profile& operator=(const local_profile&) = delete;
+
+		~local_profile() {
+			self_ = nullptr;
+			exited_ = true;
+			flush();
+			for (local_profile** link = &thread_head(); *link; link = &(*link)->next_) {
+				if (*link == this) {
+					*link = next_;
+					break;
+				}
+			}
+		}
+
+		void record(std::size_t size, std::size_t max_size) {
+			++final_sizes_[size_histogram::bucket(size)];
+			++max_sizes_[size_histogram::bucket(max_size)];
+			if (max_size > profile_.capacity()) {
+				++spills_;
+			}
+			if (++samples_ == batch_size) {
+				flush();
+			}
+		}
+
+		void flush() {
+			if (samples_ == 0) {
+				return;
+			}
+			profile_.merge(samples_, spills_, final_sizes_, max_sizes_);
+			samples_ = 0;
+			spills_ = 0;
+			std::fill(std::begin(final_sizes_), std::end(final_sizes_), 0u);
+			std::fill(std::begin(max_sizes_), std::end(max_sizes_), 0u);
+		}
+
+		// Merges the calling thread's pending samples for every profile
+		static void flush_thread() {
+			for (local_profile* local = thread_head(); local; local = local->next_) {
+				local->flush();
+			}
+		}
+
+	private:
+		capacity_profile& profile_;
+		local_profile*& self_;
+		bool& exited_;
+		local_profile* next_;
+		std::size_t samples_ = 0;
+		std::size_t spills_ = 0;
+		std::uint32_t final_sizes_[size_histogram::buckets] = {};
+		std::uint32_t max_sizes_[size_histogram::buckets] = {};
+
+		static local_profile*& thread_head() {
+			static thread_local local_profile* head = nullptr;
+			return head;
+		}
+	};
+}
+
+// Writes the capacity_profiler report for every profiled instantiation or
+// tag. It includes the calling thread's latest samples, but up to a batch of
+// each other running thread's samples may not have been merged yet.
+inline void report_capacity_profile(std::ostream& out, double quantile = 0.99) {
+	detail::local_profile::flush_thread();
+	out << "inlined_vector capacity profile\n";
+	for (const detail::capacity_profile* profile = detail::capacity_profile::registry().load(std::memory_order_acquire); profile; profile = profile->next()) {
+		profile->report(out, quantile);
+	}
+}
+
+// Records each vector's size at destruction and the largest size it reached,
+// per instantiation or per Tag if one is given. report_capacity_profile()
+// then recommends a Capacity for a target spill rate. Costs a compare when
+// the size drops and a few thread-local increments on destruction, with the
+// shared counters updated once per batch of destructions.
+template<class Tag = void, class Base = inlined_vector_policy> struct capacity_profiler : Base {
+	static constexpr bool track_high_water = true;
+
+	template<class Vector> static void on_destroy(std::size_t size, std::size_t max_size) {
+		using key = typename std::conditional<std::is_void<Tag>::value, Vector, Tag>::type;
+		if (detail::local_profile* local = detail::local_profile::of<key, Vector>()) {
+			local->record(size, max_size);
+		}
+		else {
+			detail::capacity_profile::of<key, Vector>().record(size, max_size);
+		}
+	}
+};
+
+#ifdef BSP_INLINED_VECTOR_PROFILE
+#ifndef BSP_INLINED_VECTOR_PROFILE_QUANTILE
+#define BSP_INLINED_VECTOR_PROFILE_QUANTILE 0.99
+#endif
+
+inline detail::capacity_profile::report_at_exit::~report_at_exit() {
+	report_capacity_profile(std::cerr, BSP_INLINED_VECTOR_PROFILE_QUANTILE);
+}
+#endif
+
+#if defined(BSP_INLINED_VECTOR_STATS) && defined(BSP_INLINED_VECTOR_PROFILE)
+using default_inlined_vector_policy = capacity_profiler<void, counting_policy<>>;
+#elif defined(BSP_INLINED_VECTOR_STATS)
+using default_inlined_vector_policy = counting_policy<>;
+#elif defined(BSP_INLINED_VECTOR_PROFILE)
+using default_inlined_vector_policy = capacity_profiler<>;
+#else
+using default_inlined_vector_policy = inlined_vector_policy;
+#endif
+
+// An inlined_vector is a fixed-size array with a vector-like interface
+// that can optionally grow beyond its capacity and move to the heap.
+// Allocator only provides the heap storage, elements are constructed in place.
+// Alignment applies to the start of both the inline and the heap storage.
+template<typename T, int Capacity, bool CanExpand = false, class Policy = default_inlined_vector_policy, class Allocator = std::allocator<T>, std::size_t Alignment = alignof(T)>
+class inlined_vector : public detail::inlined_vector_base<inlined_vector<T, Capacity, CanExpand, Policy, Allocator, Alignment>, T, Capacity> {
+	static_assert(Capacity > 0, "Capacity is <= 0!");
+
+public:
+	using base_t = detail::inlined_vector_base<inlined_vector<T, Capacity, CanExpand, Policy, Allocator, Alignment>, T, Capacity>;
+	using typename base_t::value_type;
+	using typename base_t::reference;
+	using typename base_t::const_reference;
+	using typename base_t::iterator;
+	using typename base_t::const_iterator;
+	using typename base_t::reverse_iterator;
+	using typename base_t::const_reverse_iterator;
+	using typename base_t::size_type;
+	using base_t::back;
+	using base_t::element;
+	using base_t::empty;
+	using base_t::end;
+	using base_t::error;
+	using base_t::full;
+	using base_t::max_size;
+
+public:
+	inlined_vector() = default;
+
+	inlined_vector(size_type count):data_internal_(std::min(count, max_size())){
+		if (count > max_size()) {
+			error("inlined_vector(count) got too many elements");
+		}
+	}
+
+	inlined_vector(size_type count, const T& value):data_internal_(std::min(count, max_size()), value){
+		if (count > max_size()) {
+			error("inlined_vector(count, value) got too many elements");
+		}
+	}
+
+	template<int Capacity_, bool CanExpand_, class Policy_, class Allocator_, std::size_t Alignment_>
+	inlined_vector(const inlined_vector<T, Capacity_, CanExpand_, Policy_, Allocator_, Alignment_>& other)
+		: inlined_vector(other.begin(), other.size()) {}
+
+	template<int Capacity_, bool CanExpand_, class Policy_, class Allocator_, std::size_t Alignment_>
+	inlined_vector(inlined_vector<T, Capacity_, CanExpand_, Policy_, Allocator_, Alignment_>&& other)
+		: inlined_vector(other.begin(), other.size()) {}
+
+	template<class Container, typename = decltype(std::declval<const Container&>().begin())>
+	inlined_vector(const Container& els) : inlined_vector(els.begin(), els.size()) {}
+
+	inlined_vector(std::initializer_list<T> els) : inlined_vector(els.begin(), els.size()) {}
+
+	inline bool can_expand() const { return false; }
+
+	inline void clear() { data_internal_.clear(); }
+
+	inline size_type size() const { return data_internal_.size(); }
+
+	inline size_type capacity() const { return Capacity; }
+
+	inline void reserve(size_type count) {
+		if (count > max_size()) {
+			error("inlined_vector::reserve exceeded Capacity");
+		}
+	}
+
+	inline void shrink_to_fit() {}
+
+	inline bool expanded() const { return false; }
+
+	template <typename U>
+	inline void push_back(U&& value) {
+		if (full()) {
+			error("inlined_vector::push_back exceeded Capacity");
+		}
+		else {
+			data_internal_.emplace_back_unchecked(std::forward<U>(value));
+		}
+	}
+
+	template<class... Args> inline void emplace_back(Args&&... args) {
+		if (full()) {
+			error("inlined_vector::emplace_back exceeded Capacity");
+		}
+		else {
+			data_internal_.emplace_back_unchecked(std::forward<Args>(args)...);
+		}
+	}
+
+	// Appends without checking for room, which is only asserted in debug
+	template <typename U>
+	inline void push_back_unchecked(U&& value) {
+		data_internal_.emplace_back_unchecked(std::forward<U>(value));
+	}
+
+	template<class... Args> inline void emplace_back_unchecked(Args&&... args) {
+		data_internal_.emplace_back_unchecked(std::forward<Args>(args)...);
+	}
+
+	// Appends if there is room and returns the new element, otherwise nullptr
+	template <typename U>
+	inline T* try_push_back(U&& value) {
+		return try_emplace_back(std::forward<U>(value));
+	}
+
+	template<class... Args> inline T* try_emplace_back(Args&&... args) {
+		if (full()) {
+			return nullptr;
+		}
+		data_internal_.emplace_back_unchecked(std::forward<Args>(args)...);
+		return end() - 1;
+	}
+
+	inline void pop_back() {
+		if (!empty()) data_internal_.pop_back();
+	}
+
+	void swap(inlined_vector& other) {
+		inlined_vector tmp(std::move(other));
+		other = std::move(*this);
+		*this = std::move(tmp);
+	}
+
+	iterator begin() { return data_internal_.begin(); }
+	const_iterator begin() const { return data_internal_.begin(); }
+
+protected:
+	friend base_t;
+
+	using array_type = detail::static_vector<T, Capacity, Alignment>;
+
+	// The only element count lives in here, sized to fit Capacity
+	array_type data_internal_;
+
+protected:
+	// Helper constructor
+	template<typename Iter, typename = typename std::enable_if<detail::is_iterator<Iter>::value>::type> 
+	inlined_vector(Iter begin_, std::size_t size) {		
+		if (size > max_size()) {
+			error("inlined_vector() too many elements");
+			size = max_size();
+		}
+
+		auto end_ = std::next(begin_, size);
+		for (auto it = begin_; it != end_; ++it){
+			data_internal_.emplace_back(std::move(*it));
+		}
+	}
+
+	template<class Construct> bool insert_with(size_type index, size_type count, Construct construct) {
+		if (size() + count > max_size()) {
+			error("inlined_vector::insert exceeded Capacity");
+			return false;
+		}
+		data_internal_.insert_with(index, count, construct);
+		return true;
+	}
+
+	inline void erase_at(size_type index, size_type count) {
+		data_internal_.erase(index, count);
+	}
+};
+
+// GCC can't tell which union member is live and warns about reading the heap
+// block from an inlined vector
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template<typename T, int Capacity, class Policy, class Allocator, std::size_t Alignment>
+class inlined_vector<T, Capacity, true, Policy, Allocator, Alignment>
+	: public detail::inlined_vector_base<inlined_vector<T, Capacity, true, Policy, Allocator, Alignment>, T, Capacity>,
+	private detail::expandable_layout<detail::expandable_storage<T, Capacity, Alignment>, Policy::cache_line, Policy::track_high_water>,
+	private detail::allocator_holder<Allocator> {
+	static_assert(Capacity > 0, "Capacity is <= 0!");
+	static_assert(std::is_same<typename Allocator::value_type, T>::value, "Allocator must allocate T");
+	static_assert(std::is_same<typename std::allocator_traits<Allocator>::pointer, T*>::value, "Allocator must use T* pointers");
+	static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two >= alignof(T)");
+
+public:
+	using base_t = detail::inlined_vector_base<inlined_vector<T, Capacity, true, Policy, Allocator, Alignment>, T, Capacity>;
+	using layout_t = detail::expandable_layout<detail::expandable_storage<T, Capacity, Alignment>, Policy::cache_line, Policy::track_high_water>;
+	using allocator_type = Allocator;
+	using typename base_t::value_type;
+	using typename base_t::reference;
+	using typename base_t::const_reference;
+	using typename base_t::iterator;
+	using typename base_t::const_iterator;
+	using typename base_t::reverse_iterator;
+	using typename base_t::const_reverse_iterator;
+	using typename base_t::size_type;
+	using base_t::empty;
+	using base_t::end;
+	using base_t::error;
+	using base_t::max_size;
+
+	static constexpr int inline_capacity = Capacity;
+
+public:
+	inlined_vector() = default;
+
+	explicit inlined_vector(const Allocator& allocator) : allocator_base(allocator) {}
+
+	inlined_vector(size_type count, const Allocator& allocator = Allocator())
+		: allocator_base(allocator) {
+		init_storage(count);
+		detail::value_construct_n(count, begin());
+		size_ = count;
+	}
+
+	inlined_vector(size_type count, const T& value, const Allocator& allocator = Allocator())
+		: allocator_base(allocator) {
+		init_storage(count);
+		detail::fill_construct_n(count, value, begin());
+		size_ = count;
+	}
+
+	template<int Capacity_, bool CanExpand_, class Policy_, class Allocator_, std::size_t Alignment_>
+	inlined_vector(const inlined_vector<T, Capacity_, CanExpand_, Policy_, Allocator_, Alignment_>& other)
+		: inlined_vector(other.begin(), other.end(), other.size()) {}
+
+	inlined_vector(inlined_vector&& other) : allocator_base(std::move(other.alloc())) {
+		take(std::move(other));
+	}
+
+	template<class Container, typename = decltype(std::declval<const Container&>().begin())>
+	inlined_vector(const Container& els) : inlined_vector(els.begin(), els.end(), els.size()) {}
+
+	inlined_vector(std::initializer_list<T> els, const Allocator& allocator = Allocator())
+		: inlined_vector(els.begin(), els.end(), els.size(), allocator) {}
+
+	inlined_vector(const inlined_vector& other)
+		: allocator_base(alloc_traits::select_on_container_copy_construction(other.alloc())) {
+		if (can_share(other)) {
+			share(other);
+			return;
+		}
+		init_storage(other.size_);
+		detail::copy_construct_n(other.begin(), other.size_, begin());
+		size_ = other.size_;
+	}
+
+	~inlined_vector() {
+		Policy::template on_destroy<inlined_vector>(size_, this->high_water(size_));
+		destroy_all();
+		release();
+	}
+
+	inlined_vector& operator=(inlined_vector&& other) {
+		if (this != &other) {
+			destroy_all();
+			move_assign(other, std::integral_constant<bool, alloc_traits::propagate_on_container_move_assignment::value>{});
+		}
+		return *this;
+	}
+
+	inlined_vector& operator=(const inlined_vector& other) {
+		if (this != &other) {
+			destroy_all();
+			copy_allocator(other, std::integral_constant<bool, alloc_traits::propagate_on_container_copy_assignment::value>{});
+			if (can_share(other)) {
+				release();
+				share(other);
+				return *this;
+			}
+			if (other.size_ > storage_capacity()) {
+				reallocate(other.size_);
+			}
+			detail::copy_construct_n(other.begin(), other.size_, begin());
+			size_ = other.size_;
+		}
+		return *this;
+	}
+
+	allocator_type get_allocator() const { return alloc(); }
+
+	void swap(inlined_vector& other) {
+		using propagate = std::integral_constant<bool, alloc_traits::propagate_on_container_swap::value>;
+		if (this == &other) {
+			return;
+		}
+		if (!inlined() && !other.inlined() && (propagate::value || alloc() == other.alloc())) {
+			this->note_size(size_);
+			other.note_size(other.size_);
+			std::swap(storage_.heap, other.storage_.heap);
+			size_.swap(other.size_);
+			swap_allocator(other, propagate{});
+		}
+		else {
+			// Inline elements can't be exchanged by pointer
+			inlined_vector tmp(std::move(other));
+			other = std::move(*this);
+			*this = std::move(tmp);
+		}
+	}
+
+	inline bool can_expand() const { return true; }
+
+	// Destroys the elements but keeps any heap storage that isn't shared
+	inline void clear() { destroy_all(); }
+
+	inline size_type size() const { return size_; }
+
+	inline size_type capacity() const { return storage_capacity(); }
+
+	// Moves to the heap if count elements won't fit in the current storage
+	inline void reserve(size_type count) {
+		if (count > storage_capacity()) {
+			reallocate(count);
+		}
+	}
+
+	// Moves the elements back inline if the policy allows, otherwise trims
+	// the heap storage down to size()
+	void shrink_to_fit() {
+		if (inlined()) {
+			return;
+		}
+		if (shared()) {
+			reallocate(size_);
+		}
+		if (size_ <= Capacity && Policy::return_inline(size_, Capacity)) {
+			heap_type heap = storage_.heap;
+			detail::relocate_n(heap.data, size_, launder(storage_.inline_));
+			deallocate(heap.data, heap.capacity);
+			size_.set_spilled(false);
+			Policy::template on_shrink<inlined_vector>();
+		}
+		else if (size_ > Capacity && size_ < storage_.heap.capacity) {
+			reallocate(size_);
+			Policy::template on_shrink<inlined_vector>();
+		}
+	}
+
+	inline bool expanded() const { return !inlined(); }
+
+	// Whether the heap storage is shared with a copy, see copy_on_write_policy
+	inline bool shared() const {
+		return Policy::copy_on_write && !inlined() && refs(storage_.heap.data).load(std::memory_order_acquire) > 1;
+	}
+
+	template <typename U>
+	inline void push_back(U&& value) {
+		emplace_back(std::forward<U>(value));
+	}
+
+	template<class... Args> inline void emplace_back(Args&&... args) {
+		if (size_ == storage_capacity()) {
+			emplace_back_grow(std::forward<Args>(args)...);
+		}
+		else {
+			new (begin() + size_) T(std::forward<Args>(args)...);
+			size_++;
+		}
+	}
+
+	// Appends without checking for room, which must already be reserved.
+	// This is only asserted in debug.
+	template <typename U>
+	inline void push_back_unchecked(U&& value) {
+		emplace_back_unchecked(std::forward<U>(value));
+	}
+
+	template<class... Args> inline void emplace_back_unchecked(Args&&... args) {
+		assert(size_ < storage_capacity());
+		new (begin() + size_) T(std::forward<Args>(args)...);
+		size_++;
+	}
+
+	// Appends if the current storage has room and returns the new element,
+	// otherwise returns nullptr without allocating
+	template <typename U>
+	inline T* try_push_back(U&& value) {
+		return try_emplace_back(std::forward<U>(value));
+	}
+
+	template<class... Args> inline T* try_emplace_back(Args&&... args) {
+		if (size_ == storage_capacity()) {
+			return nullptr;
+		}
+		T* element = new (begin() + size_) T(std::forward<Args>(args)...);
+		size_++;
+		return element;
+	}
+
+	inline void pop_back() {
+		if (!empty()){
+			this->note_size(size_);
+			size_--;
+			begin()[size_].~T();
+		}
+	}
+
+	iterator begin() {
+		if (shared()) {
+			detach();
+		}
+		return storage_begin();
+	}
+	const_iterator begin() const {
+		return inlined() ? launder(storage_.inline_) : storage_.heap.data;
+	}
+
+protected:
+	friend base_t;
+
+	using allocator_base = detail::allocator_holder<Allocator>;
+	using alloc_traits = std::allocator_traits<Allocator>;
+	using allocator_base::alloc;
+
+	using storage_type = detail::expandable_storage<T, Capacity, Alignment>;
+	using raw_type = typename storage_type::raw_type;
+	using heap_type = typename storage_type::heap_type;
+
+	using layout_t::storage_;
+	using layout_t::size_;
+
+	inline bool inlined() const { return !size_.spilled(); }
+
+	// The elements without detaching shared storage
+	inline T* storage_begin() {
+		return inlined() ? launder(storage_.inline_) : storage_.heap.data;
+	}
+
+protected:
+	// Helper constructor
+	template<typename Iter, typename = typename std::enable_if<detail::is_iterator<Iter>::value>::type>
+	inlined_vector(Iter begin_, Iter end_, size_type size, const Allocator& allocator = Allocator())
+		: allocator_base(allocator) {
+		init_storage(size);
+		T* data = begin();
+		for (auto it = begin_; it != end_; ++it, ++data){
+			new (data) T(std::move(*it));
+		}
+		size_ = size;
+	}
+
+	T* launder(raw_type* rt){
+		return reinterpret_cast<T*>(rt);
+	}
+
+	const T* launder(const raw_type* rt) const {
+		return reinterpret_cast<const T*>(rt);
+	}
+
+	inline size_type storage_capacity() const {
+		return inlined() ? Capacity : storage_.heap.capacity;
+	}
+
+	inline size_type next_capacity(size_type required) const {
+		size_type capacity = Policy::grow(storage_capacity(), required);
+		assert(capacity >= required);
+		return capacity;
+	}
+
+	T* allocate(size_type count) {
+		Policy::template on_allocate<inlined_vector>(count * sizeof(T));
+		return allocate(count, heap_kind{});
+	}
+
+	void deallocate(T* data, size_type count) {
+		Policy::template on_deallocate<inlined_vector>(count * sizeof(T));
+		deallocate(data, count, heap_kind{});
+	}
+
+	// Over-aligned heap storage is allocated as blocks of Alignment bytes,
+	// including for over-aligned T as std::allocator ignores it before C++17.
+	// Copy-on-write storage has a block for the reference count before the
+	// elements.
+	using plain_heap = std::integral_constant<int, 0>;
+	using aligned_heap = std::integral_constant<int, 1>;
+	using shared_heap = std::integral_constant<int, 2>;
+	static constexpr bool over_aligned = Alignment > alignof(T) || Alignment > alignof(std::max_align_t);
+	using heap_kind = std::integral_constant<int, Policy::copy_on_write ? 2 : over_aligned ? 1 : 0>;
+
+	static constexpr std::size_t block_size = Policy::copy_on_write && Alignment < alignof(std::max_align_t) ? alignof(std::max_align_t) : Alignment;
+	using block_allocator = typename detail::block_allocator_for<Allocator, block_size>::type;
+	using block_traits = std::allocator_traits<block_allocator>;
+	using block_type = typename block_traits::value_type;
+	using ref_count = std::atomic<std::size_t>;
+	static_assert(!Policy::copy_on_write || sizeof(ref_count) <= block_size, "The reference count must fit in a block");
+
+	static size_type block_count(size_type count) {
+		return (count * sizeof(T) + block_size - 1) / block_size;
+	}
+
+	static ref_count& refs(const T* data) {
+		return *reinterpret_cast<ref_count*>(reinterpret_cast<block_type*>(const_cast<T*>(data)) - 1);
+	}
+
+	T* allocate(size_type count, plain_heap) {
+		return alloc_traits::allocate(alloc(), count);
+	}
+
+	T* allocate(size_type count, aligned_heap) {
+		block_allocator blocks(alloc());
+		return reinterpret_cast<T*>(block_traits::allocate(blocks, block_count(count)));
+	}
+
+	T* allocate(size_type count, shared_heap) {
+		block_allocator blocks(alloc());
+		block_type* header = block_traits::allocate(blocks, 1 + block_count(count));
+		new (header) ref_count(1);
+		return reinterpret_cast<T*>(header + 1);
+	}
+
+	void deallocate(T* data, size_type count, plain_heap) {
+		alloc_traits::deallocate(alloc(), data, count);
+	}
+
+	void deallocate(T* data, size_type count, aligned_heap) {
+		block_allocator blocks(alloc());
+		block_traits::deallocate(blocks, reinterpret_cast<block_type*>(data), block_count(count));
+	}
+
+	void deallocate(T* data, size_type count, shared_heap) {
+		block_allocator blocks(alloc());
+		block_traits::deallocate(blocks, reinterpret_cast<block_type*>(data) - 1, 1 + block_count(count));
+	}
+
+	bool can_share(const inlined_vector& other) const {
+		return Policy::copy_on_write && !other.inlined() && alloc() == other.alloc();
+	}
+
+	// Adopts other's heap storage as a shared owner
+	void share(const inlined_vector& other) {
+		refs(other.storage_.heap.data).fetch_add(1, std::memory_order_relaxed);
+		storage_.heap = other.storage_.heap;
+		size_ = other.size_;
+		size_.set_spilled(true);
+	}
+
+	// Gives up this vector's reference to shared heap storage, destroying it
+	// if the other owners let go of it in the meantime
+	void unshare() {
+		if (refs(storage_.heap.data).fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			destroy_n(storage_.heap.data, size_);
+			release();
+		}
+		size_.set_spilled(false);
+	}
+
+	// Gives this vector its own copy of shared heap storage
+	void detach() {
+		reallocate(storage_.heap.capacity);
+	}
+
+	void copy_to(T* data, size_type index, size_type count, std::true_type) {
+		const T* old = storage_.heap.data;
+		detail::copy_construct_n(old, index, data);
+		detail::copy_construct_n(old + index, size_ - index, data + index + count);
+	}
+
+	// Only copy-on-write vectors share storage, and they must be copyable
+	void copy_to(T*, size_type, size_type, std::false_type) {}
+
+	void move_assign(inlined_vector& other, std::true_type) {
+		release();
+		alloc() = std::move(other.alloc());
+		take(std::move(other));
+	}
+
+	// Our allocator can't free other's heap block unless they compare equal
+	void move_assign(inlined_vector& other, std::false_type) {
+		if (alloc() == other.alloc()) {
+			release();
+			take(std::move(other));
+		}
+		else {
+			if (other.size_ > storage_capacity()) {
+				reallocate(other.size_);
+			}
+			detail::relocate_n(other.begin(), other.size_, begin());
+			size_ = other.size_;
+			other.note_size(other.size_);
+			other.size_ = 0;
+		}
+	}
+
+	void copy_allocator(const inlined_vector& other, std::true_type) {
+		if (alloc() != other.alloc()) {
+			release();
+		}
+		alloc() = other.alloc();
+	}
+
+	void copy_allocator(const inlined_vector&, std::false_type) {}
+
+	void swap_allocator(inlined_vector& other, std::true_type) {
+		using std::swap;
+		swap(alloc(), other.alloc());
+	}
+
+	void swap_allocator(inlined_vector&, std::false_type) {}
+
+	// Starts out on the heap if count elements won't fit inline
+	void init_storage(size_type count) {
+		if (count > Capacity) {
+			storage_.heap.data = allocate(count);
+			storage_.heap.capacity = count;
+			size_.set_spilled(true);
+			Policy::template on_spill<inlined_vector>(0);
+		}
+	}
+
+	// Moves the elements into data and adopts it as the heap storage,
+	// leaving count uninitialized slots at index
+	void relocate_to(T* data, size_type capacity, size_type index = 0, size_type count = 0) {
+		if (inlined()) {
+			Policy::template on_spill<inlined_vector>(size_);
+		}
+		if (shared()) {
+			copy_to(data, index, count, std::integral_constant<bool, Policy::copy_on_write>{});
+			unshare();
+		}
+		else {
+			T* old = storage_begin();
+			detail::relocate_n(old, index, data);
+			detail::relocate_n(old + index, size_ - index, data + index + count);
+			release();
+		}
+		storage_.heap.data = data;
+		storage_.heap.capacity = capacity;
+		size_.set_spilled(true);
+	}
+
+	void reallocate(size_type capacity) {
+		assert(capacity >= size_);
+		relocate_to(allocate(capacity), capacity);
+	}
+
+	// Spills or grows the heap storage to fit required elements, leaving
+	// count uninitialized slots at index
+	void grow_to_external_storage(size_type required, size_type index, size_type count) {
+		size_type capacity = next_capacity(required);
+		relocate_to(allocate(capacity), capacity, index, count);
+	}
+
+	template<class Construct> bool insert_with(size_type index, size_type count, Construct construct) {
+		if (size_ + count > storage_capacity()) {
+			grow_to_external_storage(size_ + count, index, count);
+		}
+		else {
+			detail::insert_gap(begin(), size_, index, count);
+		}
+		construct(begin() + index);
+		size_ += count;
+		return true;
+	}
+
+	inline void erase_at(size_type index, size_type count) {
+		this->note_size(size_);
+		detail::erase_n(begin(), size_, index, count);
+		size_ -= count;
+	}
+
+	// The new element is constructed before the old ones move, as args may
+	// refer to one of them
+	template<class... Args> void emplace_back_grow(Args&&... args) {
+		size_type capacity = next_capacity(size_ + 1);
+		T* data = allocate(capacity);
+		new (data + size_) T(std::forward<Args>(args)...);
+		relocate_to(data, capacity);
+		size_++;
+	}
+
+	// Steals other's heap storage or moves its inline elements
+	void take(inlined_vector&& other) {
+		other.note_size(other.size_);
+		if (other.inlined()) {
+			detail::relocate_n(other.begin(), other.size_, launder(storage_.inline_));
+			size_ = other.size_;
+			size_.set_spilled(false);
+			other.size_ = 0;
+		}
+		else {
+			storage_.heap = other.storage_.heap;
+			size_ = other.size_;
+			size_.set_spilled(true);
+			other.size_ = 0;
+			other.size_.set_spilled(false);
+		}
+	}
+
+	void destroy_all() {
+		this->note_size(size_);
+		if (shared()) {
+			unshare();
+		}
+		else {
+			destroy_n(storage_begin(), size_);
+		}
+		size_ = 0;
+	}
+
+	static void destroy_n(T* data, size_type count) {
+		for (size_type i = 0; i < count; ++i) {
+			data[i].~T();
+		}
+	}
+
+	// Frees the heap storage, the elements must already be destroyed
+	void release() {
+		if (!inlined()) {
+			deallocate(storage_.heap.data, storage_.heap.capacity);
+			size_.set_spilled(false);
+		}
+	}
+};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+template<typename T, int N, class Policy, class Allocator, std::size_t Alignment>
+inline std::ostream& operator<<(std::ostream& out, const inlined_vector<T, N, false, Policy, Allocator, Alignment>& vector) {
+	out << "inlined_vector ";
+	out << "(inlined):  [";
+	if (vector.empty())
+		out << "]";
+	else {
+		for (auto it = vector.begin(); it != vector.end(); ++it) {
+			if (std::next(it) != vector.end())
+				out << *it << ", ";
+			else
+				out << *it << "]";
+		}
+	}
+	return out;
+}
+
+template<typename T, int N, class Policy, class Allocator, std::size_t Alignment>
+inline std::ostream& operator<<(std::ostream& out, const inlined_vector<T, N, true, Policy, Allocator, Alignment>& vector) {
+	out << "inlined_vector ";
+	if (!vector.expanded())
+		out << "(inlined):  [";
+	else
+		out << "(external): [";
+	if (vector.empty())
+		out << "]";
+	else {
+		for (auto it = vector.begin(); it != vector.end(); ++it) {
+			if (std::next(it) != vector.end())
+				out << *it << ", ";
+			else
+				out << *it << "]";
+		}
+	}
+	return out;
+}
+template<typename T, int N, bool CanExpand, class Policy, class Allocator, std::size_t Alignment>
+inline void swap(inlined_vector<T, N, CanExpand, Policy, Allocator, Alignment>& a, inlined_vector<T, N, CanExpand, Policy, Allocator, Alignment>& b) {
+	a.swap(b);
+}
+
+// An expandable vector that keeps its first Capacity elements inline when it
+// spills. The overflow goes into heap segments that double in size and are
+// never moved, so spilling relocates nothing and references stay valid until
+// their element is removed. Iterators walk the segments in turn, use
+// for_each_segment() for loops that should see contiguous runs.
+template<typename T, int Capacity> class segmented_inlined_vector {
+	static_assert(Capacity > 0, "Capacity is <= 0!");
+
+	using raw_type = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+public:
+	using value_type      = T;
+	using reference       = T&;
+	using const_reference = const T&;
+	using size_type       = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	template<bool Const> class segment_iterator {
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type        = T;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = typename std::conditional<Const, const T*, T*>::type;
+		using reference         = typename std::conditional<Const, const T&, T&>::type;
+
+		segment_iterator() = default;
+
+		template<bool Const_, typename = typename std::enable_if<Const && !Const_>::type>
+		segment_iterator(const segment_iterator<Const_>& other)
+			: owner_(other.owner_), segment_(other.segment_), ptr_(other.ptr_), end_(other.end_) {}
+
+		reference operator*() const { return *ptr_; }
+		pointer operator->() const { return ptr_; }
+
+		segment_iterator& operator++() {
+			++ptr_;
+			if (ptr_ == end_ && ptr_ != owner_->tail_) {
+				++segment_;
+				ptr_ = owner_->segment_begin(segment_);
+				end_ = owner_->segment_end(segment_);
+			}
+			return *this;
+		}
+
+		segment_iterator operator++(int) {
+			segment_iterator it = *this;
+			++*this;
+			return it;
+		}
+
+		segment_iterator& operator--() {
+			if (ptr_ == owner_->segment_begin(segment_)) {
+				--segment_;
+				end_ = owner_->segment_end(segment_);
+				ptr_ = end_;
+			}
+			--ptr_;
+			return *this;
+		}
+
+		segment_iterator operator--(int) {
+			segment_iterator it = *this;
+			--*this;
+			return it;
+		}
+
+		template<bool Const_> bool operator==(const segment_iterator<Const_>& other) const { return ptr_ == other.ptr_; }
+		template<bool Const_> bool operator!=(const segment_iterator<Const_>& other) const { return ptr_ != other.ptr_; }
+
+	private:
+		friend class segmented_inlined_vector;
+		template<bool> friend class segment_iterator;
+
+		segment_iterator(const segmented_inlined_vector* owner, int segment, T* ptr, T* end)
+			: owner_(owner), segment_(segment), ptr_(ptr), end_(end) {}
+
+		const segmented_inlined_vector* owner_ = nullptr;
+		int segment_ = -1; // -1 is the inline buffer
+		T* ptr_ = nullptr;
+		T* end_ = nullptr;
+	};
+
+	using iterator = segment_iterator<false>;
+	using const_iterator = segment_iterator<true>;
+
+	segmented_inlined_vector() = default;
+
+	segmented_inlined_vector(std::initializer_list<T> els) {
+		reserve(els.size());
+		for (const T& value : els) {
+			emplace_back(value);
+		}
+	}
+
+	segmented_inlined_vector(const segmented_inlined_vector& other) {
+		append_copy(other);
+	}
+
+	segmented_inlined_vector(segmented_inlined_vector&& other) {
+		take(std::move(other));
+	}
+
+	~segmented_inlined_vector() {
+		clear();
+		release();
+	}
+
+	segmented_inlined_vector& operator=(const segmented_inlined_vector& other) {
+		if (this != &other) {
+			clear();
+			append_copy(other);
+		}
+		return *this;
+	}
+
+	segmented_inlined_vector& operator=(segmented_inlined_vector&& other) {
+		if (this != &other) {
+			clear();
+			release();
+			take(std::move(other));
+		}
+		return *this;
+	}
+
+	size_type size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	bool expanded() const { return size_ > size_type(Capacity); }
+	size_type capacity() const { return size_type(Capacity) << segments_.size(); }
+
+	// The number of segments holding elements
+	size_type segment_count() const { return static_cast<size_type>(tail_segment_ + 1 + (size_ > 0)); }
+
+	void reserve(size_type count) {
+		while (capacity() < count) {
+			allocate_segment();
+		}
+	}
+
+	// Frees the heap segments past the last element
+	void shrink_to_fit() {
+		while (static_cast<int>(segments_.size()) > tail_segment_ + 1) {
+			const int k = static_cast<int>(segments_.size()) - 1;
+			std::allocator<T>().deallocate(segments_[k], segment_capacity(k));
+			segments_.pop_back();
+		}
+	}
+
+	template<typename... Args> T& emplace_back(Args&&... args) {
+		// Nothing moves when a segment is added so args stay valid
+		T* slot = tail_ != tail_end_ ? tail_ : next_segment();
+		new (slot) T(std::forward<Args>(args)...);
+		tail_ = slot + 1;
+		++size_;
+		return *slot;
+	}
+
+	void push_back(const T& value) { emplace_back(value); }
+	void push_back(T&& value) { emplace_back(std::move(value)); }
+
+	void pop_back() {
+		assert(size_ > 0);
+		--tail_;
+		tail_->~T();
+		--size_;
+		if (size_ > 0 && tail_ == segment_begin(tail_segment_)) {
+			--tail_segment_;
+			tail_end_ = tail_ = segment_end(tail_segment_);
+		}
+	}
+
+	void clear() {
+		for_each_segment([](T* data, size_type count) {
+			for (size_type i = 0; i < count; ++i) {
+				data[i].~T();
+			}
+		});
+		size_ = 0;
+		tail_segment_ = -1;
+		tail_ = inline_data();
+		tail_end_ = tail_ + Capacity;
+	}
+
+	reference operator[](size_type i) { return *locate(i); }
+	const_reference operator[](size_type i) const { return *locate(i); }
+
+	const_reference at(size_type i) const {
+		if (i < size_) {
+			return *locate(i);
+		}
+		else {
+			throw std::out_of_range("segmented_inlined_vector::at");
+		}
+	}
+
+	reference at(size_type i) {
+		return const_cast<reference>(static_cast<const segmented_inlined_vector*>(this)->at(i));
+	}
+
+	reference front() { return *inline_data(); }
+	const_reference front() const { return *inline_data(); }
+	reference back() { return *(tail_ - 1); }
+	const_reference back() const { return *(tail_ - 1); }
+
+	iterator begin() { return first<false>(); }
+	iterator end() { return last<false>(); }
+	const_iterator begin() const { return first<true>(); }
+	const_iterator end() const { return last<true>(); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+
+	// Calls f(T* data, size_type count) for each contiguous run of elements
+	template<class F> void for_each_segment(F&& f) {
+		visit_segments(this, f);
+	}
+
+	template<class F> void for_each_segment(F&& f) const {
+		visit_segments(this, f);
+	}
+
+protected:
+	raw_type inline_[Capacity];
+	std::vector<T*> segments_; // Heap segment k holds Capacity << k elements
+	size_type size_ = 0;
+	int tail_segment_ = -1;
+	T* tail_ = inline_data();
+	T* tail_end_ = tail_ + Capacity;
+
+	T* inline_data() const {
+		return reinterpret_cast<T*>(const_cast<raw_type*>(inline_));
+	}
+
+	static size_type segment_capacity(int k) {
+		return size_type(Capacity) << k;
+	}
+
+	T* segment_begin(int k) const {
+		return k < 0 ? inline_data() : segments_[k];
+	}
+
+	T* segment_end(int k) const {
+		return k < 0 ? inline_data() + Capacity : segments_[k] + segment_capacity(k);
+	}
+
+	// Heap segment k starts at index Capacity * 2^k
+	static int segment_of(size_type i, size_type& offset) {
+		if (i < size_type(Capacity)) {
+			offset = i;
+			return -1;
+		}
+		const int k = detail::floor_log2(i / Capacity);
+		offset = i - (size_type(Capacity) << k);
+		return k;
+	}
+
+	T* locate(size_type i) const {
+		size_type offset;
+		const int k = segment_of(i, offset);
+		return segment_begin(k) + offset;
+	}
+
+	template<bool Const> segment_iterator<Const> first() const {
+		return size_ == 0 ? last<Const>() : segment_iterator<Const>(this, -1, inline_data(), inline_data() + Capacity);
+	}
+
+	template<bool Const> segment_iterator<Const> last() const {
+		return segment_iterator<Const>(this, tail_segment_, tail_, tail_end_);
+	}
+
+	template<class Self, class F> static void visit_segments(Self* self, F& f) {
+		size_type remaining = self->size_;
+		for (int k = -1; remaining > 0; ++k) {
+			const size_type count = std::min(remaining, k < 0 ? size_type(Capacity) : segment_capacity(k));
+			f(self->segment_begin(k), count);
+			remaining -= count;
+		}
+	}
+
+	void allocate_segment() {
+		const int k = static_cast<int>(segments_.size());
+		if (k == 0) {
+			segments_.reserve(8);
+		}
+		segments_.push_back(std::allocator<T>().allocate(segment_capacity(k)));
+	}
+
+	T* next_segment() {
+		if (tail_segment_ + 1 == static_cast<int>(segments_.size())) {
+			allocate_segment();
+		}
+		++tail_segment_;
+		tail_ = segment_begin(tail_segment_);
+		tail_end_ = segment_end(tail_segment_);
+		return tail_;
+	}
+
+	void append_copy(const segmented_inlined_vector& other) {
+		reserve(size_ + other.size_);
+		other.for_each_segment([this](const T* data, size_type count) {
+			for (size_type i = 0; i < count; ++i) {
+				emplace_back(data[i]);
+			}
+		});
+	}
+
+	// Only the inline elements move, the heap segments are stolen
+	void take(segmented_inlined_vector&& other) {
+		detail::relocate_n(other.inline_data(), std::min(other.size_, size_type(Capacity)), inline_data());
+		segments_ = std::move(other.segments_);
+		other.segments_.clear();
+		size_ = other.size_;
+		tail_segment_ = other.tail_segment_;
+		if (tail_segment_ < 0) {
+			tail_ = inline_data() + size_;
+			tail_end_ = inline_data() + Capacity;
+		}
+		else {
+			tail_ = other.tail_;
+			tail_end_ = other.tail_end_;
+		}
+		other.size_ = 0;
+		other.tail_segment_ = -1;
+		other.tail_ = other.inline_data();
+		other.tail_end_ = other.tail_ + Capacity;
+	}
+
+	void release() {
+		for (int k = 0; k < static_cast<int>(segments_.size()); ++k) {
+			std::allocator<T>().deallocate(segments_[k], segment_capacity(k));
+		}
+		segments_.clear();
+	}
+};
+
+namespace detail {
+	template<class Key> struct identity_key {
+		const Key& operator()(const Key& key) const { return key; }
+	};
+
+	template<class Pair> struct pair_key {
+		const typename Pair::first_type& operator()(const Pair& pair) const { return pair.first; }
+	};
+
+	// Unique elements sorted by key in an inlined_vector, shared by
+	// inlined_flat_map and inlined_flat_set. The comparator is kept in an
+	// ebo_holder so a stateless one takes no space.
+	template<class Key, class Value, class KeyOf, int Capacity, bool CanExpand, class Compare>
+	class flat_tree : private ebo_holder<Compare> {
+	public:
+		using key_type        = Key;
+		using value_type      = Value;
+		using key_compare     = Compare;
+		using container_type  = inlined_vector<Value, Capacity, CanExpand>;
+		using size_type       = std::size_t;
+		using const_iterator  = typename container_type::const_iterator;
+		// Set elements are their own keys, so they can't be modified in place
+		using iterator        = typename std::conditional<std::is_same<Key, Value>::value, const_iterator, typename container_type::iterator>::type;
+
+		// Up to this many elements are searched linearly
+		static constexpr size_type linear_search_limit = 16;
+
+	public:
+		flat_tree() = default;
+
+		explicit flat_tree(const Compare& compare) : compare_holder(compare) {}
+
+		template<class Iter, typename = typename std::enable_if<is_iterator<Iter>::value>::type>
+		flat_tree(Iter first, Iter last, const Compare& compare = Compare()) : compare_holder(compare) {
+			insert(first, last);
+		}
+
+		flat_tree(std::initializer_list<Value> values, const Compare& compare = Compare()) : compare_holder(compare) {
+			insert(values.begin(), values.end());
+		}
+
+		iterator begin() { return elements_.begin(); }
+		iterator end() { return elements_.end(); }
+		const_iterator begin() const { return elements_.begin(); }
+		const_iterator end() const { return elements_.end(); }
+		const_iterator cbegin() const { return elements_.begin(); }
+		const_iterator cend() const { return elements_.end(); }
+
+		inline bool empty() const { return elements_.empty(); }
+		inline size_type size() const { return elements_.size(); }
+		inline size_type capacity() const { return elements_.capacity(); }
+		inline bool expanded() const { return elements_.expanded(); }
+		inline void reserve(size_type count) { elements_.reserve(count); }
+		inline void shrink_to_fit() { elements_.shrink_to_fit(); }
+		inline void clear() { elements_.clear(); }
+
+		// The sorted elements
+		const container_type& elements() const { return elements_; }
+
+		key_compare key_comp() const { return this->get(); }
+
+		iterator find(const Key& key) {
+			return begin() + find_index(key);
+		}
+
+		const_iterator find(const Key& key) const {
+			return begin() + find_index(key);
+		}
+
+		inline size_type count(const Key& key) const { return find_index(key) != size() ? 1 : 0; }
+
+		inline bool contains(const Key& key) const { return find_index(key) != size(); }
+
+		iterator lower_bound(const Key& key) { return begin() + lower_bound_index(key); }
+		const_iterator lower_bound(const Key& key) const { return begin() + lower_bound_index(key); }
+
+		iterator upper_bound(const Key& key) { return begin() + upper_bound_index(key); }
+		const_iterator upper_bound(const Key& key) const { return begin() + upper_bound_index(key); }
+
+		std::pair<iterator, bool> insert(const Value& value) {
+			return emplace_at(KeyOf()(value), value);
+		}
+
+		std::pair<iterator, bool> insert(Value&& value) {
+			return emplace_at(KeyOf()(value), std::move(value));
+		}
+
+		// Sorts the range in a temporary, drops repeated and present keys,
+		// then appends the rest and merges them with the existing elements in
+		// one pass. Of several equal keys the first is kept, whether it was
+		// already present or came earlier in the range. A fixed capacity
+		// container only reports an error if the new keys don't fit.
+		template<class Iter, typename = typename std::enable_if<is_iterator<Iter>::value>::type>
+		void insert(Iter first, Iter last) {
+			inlined_vector<Value, Capacity, true> incoming;
+			incoming.append(first, last);
+			auto less_value = [this](const Value& a, const Value& b) { return less(KeyOf()(a), KeyOf()(b)); };
+			std::stable_sort(incoming.begin(), incoming.end(), less_value);
+			Value* new_end = std::unique(incoming.begin(), incoming.end(), [this](const Value& a, const Value& b) { return !less(KeyOf()(a), KeyOf()(b)); });
+			new_end = std::remove_if(incoming.begin(), new_end, [this](const Value& value) { return contains(KeyOf()(value)); });
+			if (new_end == incoming.begin()) {
+				return;
+			}
+			const size_type old_size = size();
+			elements_.append(std::make_move_iterator(incoming.begin()), std::make_move_iterator(new_end));
+			if (size() == old_size) {
+				return;
+			}
+			std::inplace_merge(elements_.begin(), elements_.begin() + old_size, elements_.end(), less_value);
+		}
+
+		void insert(std::initializer_list<Value> values) {
+			insert(values.begin(), values.end());
+		}
+
+		iterator erase(const_iterator it) { return elements_.erase(it); }
+
+		iterator erase(const_iterator first, const_iterator last) { return elements_.erase(first, last); }
+
+		size_type erase(const Key& key) {
+			size_type i = find_index(key);
+			if (i == size()) {
+				return 0;
+			}
+			elements_.erase(elements_.begin() + i);
+			return 1;
+		}
+
+		void swap(flat_tree& other) {
+			using std::swap;
+			elements_.swap(other.elements_);
+			swap(this->get(), other.get());
+		}
+
+	protected:
+		using compare_holder = ebo_holder<Compare>;
+
+		inline bool less(const Key& a, const Key& b) const { return this->get()(a, b); }
+
+		// Counts the smaller keys rather than stopping at the first larger
+		// one, as the loop without an early exit can be vectorised
+		size_type lower_bound_index(const Key& key) const {
+			const Value* data = elements_.begin();
+			const size_type n = size();
+			if (n <= linear_search_limit) {
+				size_type index = 0;
+				for (size_type i = 0; i < n; ++i) {
+					index += less(KeyOf()(data[i]), key) ? 1 : 0;
+				}
+				return index;
+			}
+			return static_cast<size_type>(std::lower_bound(data, data + n, key, [this](const Value& value, const Key& k) {
+				return less(KeyOf()(value), k);
+			}) - data);
+		}
+
+		size_type upper_bound_index(const Key& key) const {
+			const Value* data = elements_.begin();
+			const size_type n = size();
+			if (n <= linear_search_limit) {
+				size_type index = 0;
+				for (size_type i = 0; i < n; ++i) {
+					index += less(key, KeyOf()(data[i])) ? 0 : 1;
+				}
+				return index;
+			}
+			return static_cast<size_type>(std::upper_bound(data, data + n, key, [this](const Key& k, const Value& value) {
+				return less(k, KeyOf()(value));
+			}) - data);
+		}
+
+		// The index of key, or size() if it isn't present
+		size_type find_index(const Key& key) const {
+			size_type i = lower_bound_index(key);
+			return i < size() && !less(key, KeyOf()(elements_[i])) ? i : size();
+		}
+
+		// Constructs the element for key from args unless key is present. A
+		// full fixed capacity container reports an error and returns end().
+		template<class... Args> std::pair<iterator, bool> emplace_at(const Key& key, Args&&... args) {
+			size_type i = lower_bound_index(key);
+			if (i < size() && !less(key, KeyOf()(elements_[i]))) {
+				return { begin() + i, false };
+			}
+			iterator it = elements_.emplace(elements_.begin() + i, std::forward<Args>(args)...);
+			return { it, it != end() };
+		}
+
+		container_type elements_;
+	};
+}
+
+// A sorted map of up to Capacity entries stored inline, spilling to the heap
+// if CanExpand. Lookups are a linear scan up to linear_search_limit entries
+// and a binary search beyond that. Inserting or erasing moves the entries
+// after it, so build large maps with the bulk insert(first, last).
+// Iterators are pointers and are invalidated by insertion and erasure, and
+// the keys must not be modified through them.
+template<class Key, class T, int Capacity, bool CanExpand = false, class Compare = std::less<Key>>
+class inlined_flat_map : public detail::flat_tree<Key, std::pair<Key, T>, detail::pair_key<std::pair<Key, T>>, Capacity, CanExpand, Compare> {
+public:
+	using base_t = detail::flat_tree<Key, std::pair<Key, T>, detail::pair_key<std::pair<Key, T>>, Capacity, CanExpand, Compare>;
+	using mapped_type = T;
+	using typename base_t::value_type;
+	using typename base_t::iterator;
+	using typename base_t::const_iterator;
+	using base_t::base_t;
+	using base_t::insert;
+
+	inlined_flat_map() = default;
+
+	template<class... Args> std::pair<iterator, bool> emplace(Args&&... args) {
+		value_type value(std::forward<Args>(args)...);
+		return this->emplace_at(value.first, std::move(value));
+	}
+
+	// Only constructs the value if key is missing
+	template<class... Args> std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+		return this->emplace_at(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+
+	template<class M> std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value) {
+		auto result = try_emplace(key, std::forward<M>(value));
+		if (!result.second && result.first != this->end()) {
+			result.first->second = std::forward<M>(value);
+		}
+		return result;
+	}
+
+	// Inserts a value-initialized entry if key is missing. If a full fixed
+	// capacity map can't, it reports an error and, as there is no entry to
+	// return, throws std::length_error even without BSP_INLINED_VECTOR_THROWS.
+	T& operator[](const Key& key) {
+		iterator it = try_emplace(key).first;
+		if (it == this->end()) {
+			throw std::length_error("inlined_flat_map::operator[]");
+		}
+		return it->second;
+	}
+
+	T& at(const Key& key) {
+		return const_cast<T&>(static_cast<const inlined_flat_map*>(this)->at(key));
+	}
+
+	const T& at(const Key& key) const {
+		const_iterator it = this->find(key);
+		if (it == this->end()) {
+			throw std::out_of_range("inlined_flat_map::at");
+		}
+		return it->second;
+	}
+};
+
+// A sorted set of up to Capacity keys stored inline, spilling to the heap if
+// CanExpand. Searched and updated like inlined_flat_map.
+template<class Key, int Capacity, bool CanExpand = false, class Compare = std::less<Key>>
+class inlined_flat_set : public detail::flat_tree<Key, Key, detail::identity_key<Key>, Capacity, CanExpand, Compare> {
+public:
+	using base_t = detail::flat_tree<Key, Key, detail::identity_key<Key>, Capacity, CanExpand, Compare>;
+	using typename base_t::iterator;
+	using base_t::base_t;
+
+	inlined_flat_set() = default;
+
+	template<class... Args> std::pair<iterator, bool> emplace(Args&&... args) {
+		Key key(std::forward<Args>(args)...);
+		return this->emplace_at(key, std::move(key));
+	}
+};
+
+// A null-terminated string of up to Capacity chars stored inline, spilling to
+// the heap like an expandable inlined_vector<char>. The terminator is kept as
+// the last char of the underlying vector, so c_str() is always valid.
+template<int Capacity, class Policy = default_inlined_vector_policy> class inlined_string {
+	static_assert(Capacity > 0, "Capacity is <= 0!");
+
+public:
+	using value_type      = char;
+	using size_type       = std::size_t;
+	using reference       = char&;
+	using const_reference = const char&;
+	using iterator        = char*;
+	using const_iterator  = const char*;
+	using container_type  = inlined_vector<char, Capacity + 1, true, Policy>;
+
+	static constexpr size_type npos = static_cast<size_type>(-1);
+	static constexpr int inline_capacity = Capacity;
+
+public:
+	inlined_string() : chars_(1, '\0') {}
+
+	inlined_string(const char* s) : inlined_string(s, std::strlen(s)) {}
+
+	inlined_string(const char* s, size_type count) {
+		assign(s, count);
+	}
+
+	inlined_string(size_type count, char ch) : chars_(count + 1, ch) {
+		chars_[count] = '\0';
+	}
+
+	inlined_string(const std::string& s) : inlined_string(s.data(), s.size()) {}
+
+#ifdef BSP_INLINED_VECTOR_HAS_STRING_VIEW
+	inlined_string(std::string_view s) : inlined_string(s.data(), s.size()) {}
+#endif
+
+	inlined_string(const inlined_string&) = default;
+
+	// Leaves other empty rather than without a terminator
+	inlined_string(inlined_string&& other) : chars_(std::move(other.chars_)) {
+		other.chars_.push_back('\0');
+	}
+
+	inlined_string& operator=(const inlined_string&) = default;
+
+	inlined_string& operator=(inlined_string&& other) {
+		if (this != &other) {
+			chars_ = std::move(other.chars_);
+			other.chars_.clear();
+			other.chars_.push_back('\0');
+		}
+		return *this;
+	}
+
+	inlined_string& operator=(const char* s) { return assign(s, std::strlen(s)); }
+
+	// s may point into this string
+	inlined_string& assign(const char* s, size_type count) {
+		chars_.resize_default_init(count + 1);
+		std::memmove(chars_.begin(), s, count);
+		chars_[count] = '\0';
+		return *this;
+	}
+
+	iterator begin() { return chars_.begin(); }
+	iterator end() { return chars_.begin() + size(); }
+	const_iterator begin() const { return chars_.begin(); }
+	const_iterator end() const { return chars_.begin() + size(); }
+
+	inline const char* c_str() const { return chars_.begin(); }
+	inline const char* data() const { return chars_.begin(); }
+	inline char* data() { return chars_.begin(); }
+
+	inline size_type size() const { return chars_.size() - 1; }
+	inline size_type length() const { return size(); }
+	inline bool empty() const { return size() == 0; }
+	inline size_type capacity() const { return chars_.capacity() - 1; }
+	inline bool expanded() const { return chars_.expanded(); }
+	inline void reserve(size_type count) { chars_.reserve(count + 1); }
+	inline void shrink_to_fit() { chars_.shrink_to_fit(); }
+
+	inline char& operator[](size_type i) { return chars_[i]; }
+	inline const char& operator[](size_type i) const { return chars_[i]; }
+
+	inline const char& at(size_type i) const {
+		if (i >= size()) {
+			throw std::out_of_range("inlined_string::at");
+		}
+		return chars_[i];
+	}
+
+	inline char& at(size_type i) {
+		return const_cast<char&>(static_cast<const inlined_string*>(this)->at(i));
+	}
+
+	inline char& front() { return chars_.front(); }
+	inline const char& front() const { return chars_.front(); }
+	// An empty string's front() and back() are its terminator
+	inline char& back() { return chars_[empty() ? 0 : size() - 1]; }
+	inline const char& back() const { return chars_[empty() ? 0 : size() - 1]; }
+
+	inline void clear() {
+		chars_.clear();
+		chars_.push_back('\0');
+	}
+
+	inline void push_back(char ch) {
+		chars_.back() = ch;
+		chars_.push_back('\0');
+	}
+
+	inline void pop_back() {
+		if (!empty()) {
+			chars_.pop_back();
+			chars_.back() = '\0';
+		}
+	}
+
+	void resize(size_type count, char ch = '\0') {
+		chars_.back() = ch;
+		chars_.resize(count + 1, ch);
+		chars_[count] = '\0';
+	}
+
+	// s may point into this string
+	inlined_string& append(const char* s, size_type count) {
+		const size_type length = size();
+		const char* old = chars_.begin();
+		if (!std::less<const char*>()(s, old) && std::less<const char*>()(s, old + length)) {
+			const size_type offset = static_cast<size_type>(s - old);
+			chars_.resize_default_init(length + count + 1);
+			s = chars_.begin() + offset;
+		}
+		else {
+			chars_.resize_default_init(length + count + 1);
+		}
+		std::memcpy(chars_.begin() + length, s, count);
+		chars_[length + count] = '\0';
+		return *this;
+	}
+
+	inlined_string& append(const char* s) { return append(s, std::strlen(s)); }
+
+	inlined_string& append(size_type count, char ch) {
+		resize(size() + count, ch);
+		return *this;
+	}
+
+	template<int Capacity_, class Policy_> inlined_string& append(const inlined_string<Capacity_, Policy_>& s) {
+		return append(s.data(), s.size());
+	}
+
+	inlined_string& operator+=(char ch) {
+		push_back(ch);
+		return *this;
+	}
+
+	inlined_string& operator+=(const char* s) { return append(s); }
+
+	template<int Capacity_, class Policy_> inlined_string& operator+=(const inlined_string<Capacity_, Policy_>& s) {
+		return append(s.data(), s.size());
+	}
+
+	inlined_string& erase(size_type pos = 0, size_type count = npos) {
+		if (pos > size()) {
+			throw std::out_of_range("inlined_string::erase");
+		}
+		count = std::min(count, size() - pos);
+		chars_.erase(chars_.begin() + pos, chars_.begin() + pos + count);
+		return *this;
+	}
+
+	inlined_string substr(size_type pos = 0, size_type count = npos) const {
+		if (pos > size()) {
+			throw std::out_of_range("inlined_string::substr");
+		}
+		return inlined_string(data() + pos, std::min(count, size() - pos));
+	}
+
+	size_type find(char ch, size_type pos = 0) const {
+		if (pos >= size()) {
+			return npos;
+		}
+		const void* found = std::memchr(data() + pos, ch, size() - pos);
+		return found ? static_cast<size_type>(static_cast<const char*>(found) - data()) : npos;
+	}
+
+	// Uses memchr to skip to each candidate for the first char, then memcmp
+	size_type find(const char* s, size_type pos, size_type count) const {
+		if (pos > size() || count > size() - pos) {
+			return npos;
+		}
+		if (count == 0) {
+			return pos;
+		}
+		const char* first = data() + pos;
+		const char* last = data() + size() - count + 1;
+		while (first < last) {
+			first = static_cast<const char*>(std::memchr(first, s[0], static_cast<size_type>(last - first)));
+			if (!first) {
+				return npos;
+			}
+			if (std::memcmp(first, s, count) == 0) {
+				return static_cast<size_type>(first - data());
+			}
+			++first;
+		}
+		return npos;
+	}
+
+	size_type find(const char* s, size_type pos = 0) const { return find(s, pos, std::strlen(s)); }
+
+	template<int Capacity_, class Policy_> size_type find(const inlined_string<Capacity_, Policy_>& s, size_type pos = 0) const {
+		return find(s.data(), pos, s.size());
+	}
+
+	int compare(const char* s, size_type count) const {
+		const size_type common = std::min(size(), count);
+		const int result = common ? std::memcmp(data(), s, common) : 0;
+		if (result != 0) {
+			return result;
+		}
+		return size() < count ? -1 : size() > count ? 1 : 0;
+	}
+
+	int compare(const char* s) const { return compare(s, std::strlen(s)); }
+
+	template<int Capacity_, class Policy_> int compare(const inlined_string<Capacity_, Policy_>& s) const {
+		return compare(s.data(), s.size());
+	}
+
+	std::string str() const { return std::string(data(), size()); }
+
+#ifdef BSP_INLINED_VECTOR_HAS_STRING_VIEW
+	inlined_string& append(std::string_view s) { return append(s.data(), s.size()); }
+	inlined_string& operator+=(std::string_view s) { return append(s.data(), s.size()); }
+	size_type find(std::string_view s, size_type pos = 0) const { return find(s.data(), pos, s.size()); }
+	int compare(std::string_view s) const { return compare(s.data(), s.size()); }
+
+	operator std::string_view() const { return std::string_view(data(), size()); }
+#endif
+
+	void swap(inlined_string& other) { chars_.swap(other.chars_); }
+
+private:
+	container_type chars_;
+};
+
+template<int Capacity, class Policy> constexpr typename inlined_string<Capacity, Policy>::size_type inlined_string<Capacity, Policy>::npos;
+
+// Equality checks the sizes before comparing any chars
+template<int C1, class P1, int C2, class P2>
+inline bool operator==(const inlined_string<C1, P1>& a, const inlined_string<C2, P2>& b) {
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+template<int C1, class P1, int C2, class P2>
+inline bool operator!=(const inlined_string<C1, P1>& a, const inlined_string<C2, P2>& b) { return !(a == b); }
+
+template<int C1, class P1, int C2, class P2>
+inline bool operator<(const inlined_string<C1, P1>& a, const inlined_string<C2, P2>& b) { return a.compare(b) < 0; }
+
+template<int C1, class P1, int C2, class P2>
+inline bool operator>(const inlined_string<C1, P1>& a, const inlined_string<C2, P2>& b) { return b < a; }
+
+template<int C1, class P1, int C2, class P2>
+inline bool operator<=(const inlined_string<C1, P1>& a, const inlined_string<C2, P2>& b) { return !(b < a); }
+
+template<int C1, class P1, int C2, class P2>
+inline bool operator>=(const inlined_string<C1, P1>& a, const inlined_string<C2, P2>& b) { return !(a < b); }
+
+template<int C, class P> inline bool operator==(const inlined_string<C, P>& a, const char* b) { return a.compare(b) == 0; }
+template<int C, class P> inline bool operator==(const char* a, const inlined_string<C, P>& b) { return b.compare(a) == 0; }
+template<int C, class P> inline bool operator!=(const inlined_string<C, P>& a, const char* b) { return a.compare(b) != 0; }
+template<int C, class P> inline bool operator!=(const char* a, const inlined_string<C, P>& b) { return b.compare(a) != 0; }
+
+template<int C, class P> std::ostream& operator<<(std::ostream& out, const inlined_string<C, P>& s) {
+	return out.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+template<int C, class P> inline void swap(inlined_string<C, P>& a, inlined_string<C, P>& b) {
+	a.swap(b);
+}
+
+// A vector of bits packed into 64-bit words, with room for at least Bits
+// inline. If CanExpand it spills to the heap like inlined_vector. The bits
+// past size() in the last word are kept clear, so counting, searching and the
+// bitwise operators work a word at a time.
+template<int Bits, bool CanExpand = false> class inlined_bitvector {
+	static_assert(Bits > 0, "Bits is <= 0!");
+
+public:
+	using word_type = std::uint64_t;
+	using size_type = std::size_t;
+
+	static constexpr size_type word_bits = 64;
+	static constexpr int inline_words = static_cast<int>((Bits + word_bits - 1) / word_bits);
+	static constexpr size_type npos = static_cast<size_type>(-1);
+
+	using container_type = inlined_vector<word_type, inline_words, CanExpand>;
+
+public:
+	inlined_bitvector() = default;
+
+	explicit inlined_bitvector(size_type count, bool value = false) {
+		resize(count, value);
+	}
+
+	inline size_type size() const { return size_; }
+	inline bool empty() const { return size_ == 0; }
+	inline size_type capacity() const { return words_.capacity() * word_bits; }
+	inline bool expanded() const { return words_.expanded(); }
+	inline void reserve(size_type count) { words_.reserve(word_count(count)); }
+
+	// The packed words, least significant bit first
+	const container_type& words() const { return words_; }
+
+	inline bool test(size_type i) const { return (words_[i / word_bits] >> (i % word_bits)) & 1; }
+	inline bool operator[](size_type i) const { return test(i); }
+
+	inline inlined_bitvector& set(size_type i, bool value = true) {
+		const word_type mask = word_type(1) << (i % word_bits);
+		word_type& word = words_[i / word_bits];
+		word = value ? word | mask : word & ~mask;
+		return *this;
+	}
+
+	inline inlined_bitvector& reset(size_type i) { return set(i, false); }
+
+	inline inlined_bitvector& flip(size_type i) {
+		words_[i / word_bits] ^= word_type(1) << (i % word_bits);
+		return *this;
+	}
+
+	inlined_bitvector& set() {
+		std::fill(words_.begin(), words_.end(), ~word_type(0));
+		clear_unused();
+		return *this;
+	}
+
+	inlined_bitvector& reset() {
+		std::fill(words_.begin(), words_.end(), word_type(0));
+		return *this;
+	}
+
+	inlined_bitvector& flip() {
+		for (word_type& word : words_) {
+			word = ~word;
+		}
+		clear_unused();
+		return *this;
+	}
+
+	inline void clear() {
+		words_.clear();
+		size_ = 0;
+	}
+
+	void push_back(bool value) {
+		if (size_ % word_bits == 0) {
+			const size_type words = words_.size();
+			words_.push_back(0);
+			if (words_.size() == words) {
+				return;
+			}
+		}
+		set(size_++, value);
+	}
+
+	void pop_back() {
+		if (size_ > 0) {
+			reset(--size_);
+			if (size_ % word_bits == 0) {
+				words_.pop_back();
+			}
+		}
+	}
+
+	void resize(size_type count, bool value = false) {
+		if (count > size_ && value && size_ % word_bits != 0) {
+			words_.back() |= ~word_type(0) << (size_ % word_bits);
+		}
+		words_.resize(word_count(count), value ? ~word_type(0) : word_type(0));
+		size_ = std::min(count, words_.size() * word_bits);
+		clear_unused();
+	}
+
+	size_type count() const {
+		size_type result = 0;
+		for (word_type word : words_) {
+			result += static_cast<size_type>(detail::popcount(word));
+		}
+		return result;
+	}
+
+	bool any() const {
+		for (word_type word : words_) {
+			if (word != 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline bool none() const { return !any(); }
+
+	inline bool all() const { return count() == size_; }
+
+	// The index of the first set bit, or npos if there isn't one
+	inline size_type find_first() const { return find_from(0); }
+
+	// The index of the first set bit after pos, or npos if there isn't one
+	inline size_type find_next(size_type pos) const {
+		return pos == npos || pos + 1 >= size_ ? npos : find_from(pos + 1);
+	}
+
+	// The bitwise operators treat a shorter other as padded with zeros
+	template<int Bits_, bool CanExpand_> inlined_bitvector& operator&=(const inlined_bitvector<Bits_, CanExpand_>& other) {
+		const size_type common = std::min(words_.size(), other.words().size());
+		for (size_type i = 0; i < common; ++i) {
+			words_[i] &= other.words()[i];
+		}
+		std::fill(words_.begin() + common, words_.end(), word_type(0));
+		return *this;
+	}
+
+	template<int Bits_, bool CanExpand_> inlined_bitvector& operator|=(const inlined_bitvector<Bits_, CanExpand_>& other) {
+		const size_type common = std::min(words_.size(), other.words().size());
+		for (size_type i = 0; i < common; ++i) {
+			words_[i] |= other.words()[i];
+		}
+		clear_unused();
+		return *this;
+	}
+
+	template<int Bits_, bool CanExpand_> inlined_bitvector& operator^=(const inlined_bitvector<Bits_, CanExpand_>& other) {
+		const size_type common = std::min(words_.size(), other.words().size());
+		for (size_type i = 0; i < common; ++i) {
+			words_[i] ^= other.words()[i];
+		}
+		clear_unused();
+		return *this;
+	}
+
+	inlined_bitvector operator~() const {
+		inlined_bitvector result(*this);
+		result.flip();
+		return result;
+	}
+
+	bool operator==(const inlined_bitvector& other) const {
+		return size_ == other.size_ && std::equal(words_.begin(), words_.end(), other.words_.begin());
+	}
+
+	bool operator!=(const inlined_bitvector& other) const { return !(*this == other); }
+
+	void swap(inlined_bitvector& other) {
+		words_.swap(other.words_);
+		std::swap(size_, other.size_);
+	}
+
+private:
+	static size_type word_count(size_type bits) { return (bits + word_bits - 1) / word_bits; }
+
+	inline void clear_unused() {
+		if (size_ % word_bits != 0) {
+			words_.back() &= (word_type(1) << (size_ % word_bits)) - 1;
+		}
+	}
+
+	size_type find_from(size_type i) const {
+		size_type w = i / word_bits;
+		if (w >= words_.size()) {
+			return npos;
+		}
+		word_type word = words_[w] & (~word_type(0) << (i % word_bits));
+		while (word == 0) {
+			if (++w == words_.size()) {
+				return npos;
+			}
+			word = words_[w];
+		}
+		return w * word_bits + static_cast<size_type>(detail::count_trailing_zeros(word));
+	}
+
+	container_type words_;
+	size_type size_ = 0;
+};
+
+template<int Bits, bool CanExpand> constexpr typename inlined_bitvector<Bits, CanExpand>::size_type inlined_bitvector<Bits, CanExpand>::word_bits;
+template<int Bits, bool CanExpand> constexpr typename inlined_bitvector<Bits, CanExpand>::size_type inlined_bitvector<Bits, CanExpand>::npos;
+
+template<int Bits, bool CanExpand> inline inlined_bitvector<Bits, CanExpand> operator&(inlined_bitvector<Bits, CanExpand> a, const inlined_bitvector<Bits, CanExpand>& b) {
+	a &= b;
+	return a;
+}
+
+template<int Bits, bool CanExpand> inline inlined_bitvector<Bits, CanExpand> operator|(inlined_bitvector<Bits, CanExpand> a, const inlined_bitvector<Bits, CanExpand>& b) {
+	a |= b;
+	return a;
+}
+
+template<int Bits, bool CanExpand> inline inlined_bitvector<Bits, CanExpand> operator^(inlined_bitvector<Bits, CanExpand> a, const inlined_bitvector<Bits, CanExpand>& b) {
+	a ^= b;
+	return a;
+}
+
+template<int Bits, bool CanExpand> inline void swap(inlined_bitvector<Bits, CanExpand>& a, inlined_bitvector<Bits, CanExpand>& b) {
+	a.swap(b);
+}
+
+// A double-ended queue of up to Capacity elements in an inline ring buffer,
+// with O(1) pushes and pops at both ends. If CanExpand, a full ring moves to
+// a larger ring on the heap, otherwise overflowing reports an error. Elements
+// wrap around the end of the buffer, so they form at most two contiguous
+// runs, see for_each_segment().
+template<typename T, int Capacity, bool CanExpand = false> class inlined_deque {
+	static_assert(Capacity > 0, "Capacity is <= 0!");
+
+	using raw_type = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+public:
+	using value_type      = T;
+	using reference       = T&;
+	using const_reference = const T&;
+	using size_type       = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	template<bool Const> class ring_iterator {
+		using owner_type = typename std::conditional<Const, const inlined_deque, inlined_deque>::type;
+
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type        = T;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = typename std::conditional<Const, const T*, T*>::type;
+		using reference         = typename std::conditional<Const, const T&, T&>::type;
+
+		ring_iterator() = default;
+
+		template<bool Const_, typename = typename std::enable_if<Const && !Const_>::type>
+		ring_iterator(const ring_iterator<Const_>& other) : owner_(other.owner_), index_(other.index_) {}
+
+		reference operator*() const { return (*owner_)[index_]; }
+		pointer operator->() const { return &(*owner_)[index_]; }
+		reference operator[](difference_type n) const { return (*owner_)[index_ + n]; }
+
+		ring_iterator& operator++() { ++index_; return *this; }
+		ring_iterator& operator--() { --index_; return *this; }
+		ring_iterator operator++(int) { ring_iterator it = *this; ++index_; return it; }
+		ring_iterator operator--(int) { ring_iterator it = *this; --index_; return it; }
+
+		ring_iterator& operator+=(difference_type n) { index_ += n; return *this; }
+		ring_iterator& operator-=(difference_type n) { index_ -= n; return *this; }
+		ring_iterator operator+(difference_type n) const { return ring_iterator(owner_, index_ + n); }
+		ring_iterator operator-(difference_type n) const { return ring_iterator(owner_, index_ - n); }
+		friend ring_iterator operator+(difference_type n, const ring_iterator& it) { return it + n; }
+
+		template<bool Const_> difference_type operator-(const ring_iterator<Const_>& other) const {
+			return static_cast<difference_type>(index_) - static_cast<difference_type>(other.index_);
+		}
+
+		template<bool Const_> bool operator==(const ring_iterator<Const_>& other) const { return index_ == other.index_; }
+		template<bool Const_> bool operator!=(const ring_iterator<Const_>& other) const { return index_ != other.index_; }
+		template<bool Const_> bool operator<(const ring_iterator<Const_>& other) const { return index_ < other.index_; }
+		template<bool Const_> bool operator>(const ring_iterator<Const_>& other) const { return index_ > other.index_; }
+		template<bool Const_> bool operator<=(const ring_iterator<Const_>& other) const { return index_ <= other.index_; }
+		template<bool Const_> bool operator>=(const ring_iterator<Const_>& other) const { return index_ >= other.index_; }
+
+	private:
+		friend class inlined_deque;
+		template<bool> friend class ring_iterator;
+
+		ring_iterator(owner_type* owner, size_type index) : owner_(owner), index_(index) {}
+
+		owner_type* owner_ = nullptr;
+		size_type index_ = 0; // Logical, counted from the front
+	};
+
+	using iterator = ring_iterator<false>;
+	using const_iterator = ring_iterator<true>;
+
+	static constexpr int inline_capacity = Capacity;
+
+public:
+	inlined_deque() = default;
 
-	size_type iterator_index(const_iterator it) const {
-		auto nit = begin();
-		for (size_type i = 0; i < size_; i++) {
-			if (nit == it)
-				return i;
-			nit++;
+	inlined_deque(std::initializer_list<T> els) {
+		reserve(els.size());
+		for (const T& value : els) {
+			emplace_back(value);
 		}
-		return size_;
 	}
 
-	inline void validate_iterator(const_iterator it) {
-#ifndef NDEBUG
-		if (it < begin() || it > end()) {
-			error("inlined_vector::validate_iterator invalid iterator");
+	inlined_deque(const inlined_deque& other) {
+		reserve(other.size_);
+		for (const T& value : other) {
+			emplace_back(value);
 		}
-#endif
 	}
 
-	void error(const char* message) const {
-#ifdef BSP_INLINED_VECTOR_LOG_ERROR
-		BSP_INLINED_VECTOR_LOG_ERROR(message);
-#endif
+	inlined_deque(inlined_deque&& other) {
+		take(other);
+	}
 
-#ifdef BSP_INLINED_VECTOR_THROWS
-		throw std::runtime_error(message);
-#endif
+	~inlined_deque() {
+		clear();
+		release();
 	}
 
-	template<typename T2, int N>
-	friend std::ostream& operator<<(std::ostream& out, const inlined_vector<T2, N, false>& vector);
-};
+	inlined_deque& operator=(const inlined_deque& other) {
+		if (this != &other) {
+			clear();
+			reserve(other.size_);
+			for (const T& value : other) {
+				emplace_back(value);
+			}
+		}
+		return *this;
+	}
 
-template<typename T, int Capacity>
-class inlined_vector<T, Capacity, true> : public inlined_vector<T, Capacity, false> {
-	static_assert(Capacity > 0, "Capacity is <= 0!");
+	inlined_deque& operator=(inlined_deque&& other) {
+		if (this != &other) {
+			clear();
+			release();
+			take(other);
+		}
+		return *this;
+	}
 
-public:
-	using base_t = inlined_vector<T, Capacity, false>;
-	using typename base_t::value_type;
-	using typename base_t::reference;
-	using typename base_t::const_reference;
-	using typename base_t::iterator;
-	using typename base_t::const_iterator;
-	using typename base_t::reverse_iterator;
-	using typename base_t::const_reverse_iterator;
-	using typename base_t::size_type;
-	using base_t::cbegin;
-	using base_t::element;
-	using base_t::empty;
-	using base_t::end;
-	using base_t::error;
-	using base_t::max_size;
-	using base_t::rbegin;
-	using base_t::data_internal_;
-	using base_t::size_;
+	void swap(inlined_deque& other) {
+		inlined_deque tmp(std::move(other));
+		other = std::move(*this);
+		*this = std::move(tmp);
+	}
 
-public:
-	inlined_vector() = default;
+	inline bool can_expand() const { return CanExpand; }
+	inline size_type size() const { return size_; }
+	inline bool empty() const { return size_ == 0; }
+	inline bool full() const { return size_ == capacity_; }
+	inline size_type capacity() const { return capacity_; }
+	inline bool expanded() const { return heap_ != nullptr; }
 
-	inlined_vector(size_type count, const T& value = T()){
-		size_ = count;
-		if (size_ <= max_size()){
-			data_internal_.fill_n(count, value);
-		}
-		else {
-			data_external_.resize(size_);
-			std::fill_n(data_external_.begin(), count, value);
-			inlined_ = false;
+	inline reference operator[](size_type i) { return buffer()[physical(i)]; }
+	inline const_reference operator[](size_type i) const { return buffer()[physical(i)]; }
+
+	const_reference at(size_type i) const {
+		if (i >= size_) {
+			throw std::out_of_range("inlined_deque::at");
 		}
+		return (*this)[i];
 	}
 
-	template<std::size_t Capacity_, bool CanExpand_>
-	inlined_vector(const inlined_vector<T, Capacity_, CanExpand_>& other)
-		: inlined_vector(other.begin(), other.end(), other.size()) {}
+	reference at(size_type i) {
+		return const_cast<reference>(static_cast<const inlined_deque*>(this)->at(i));
+	}
 
-	inlined_vector(inlined_vector&& other)
-		: base_t(std::move(other.data_internal_), other.size_),
-		data_external_(std::move(other.data_external_)), 
-		inlined_(other.inlined_) {
-		other.inlined_ = true;
-		other.size_ = 0;
+	inline reference front() { return buffer()[head_]; }
+	inline const_reference front() const { return buffer()[head_]; }
+	inline reference back() { return (*this)[size_ - 1]; }
+	inline const_reference back() const { return (*this)[size_ - 1]; }
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, size_); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, size_); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+
+	// Calls f(T* data, size_type count) for the run from the front up to the
+	// end of the buffer, then for the run that wrapped around, if any
+	template<class F> void for_each_segment(F&& f) {
+		visit_segments(this, f);
 	}
 
-	template<class Container>
-	inlined_vector(const Container& els) : inlined_vector(els.begin(), els.end(), els.size()) {}
+	template<class F> void for_each_segment(F&& f) const {
+		visit_segments(this, f);
+	}
 
-	inlined_vector(std::initializer_list<T> els)
-		: inlined_vector(els.begin(), els.end(), els.size()) {}
+	// Moves to a heap ring if count elements won't fit
+	void reserve(size_type count) {
+		if (count > capacity_) {
+			if (!CanExpand) {
+				detail::report_error("inlined_deque::reserve exceeded Capacity");
+				return;
+			}
+			relocate_to(allocate(count), count);
+		}
+	}
 
-	inlined_vector(const inlined_vector& other)
-		: inlined_vector(other.begin(), other.end(), other.size()) {}
+	template <typename U> inline void push_back(U&& value) {
+		emplace_back(std::forward<U>(value));
+	}
 
-	inlined_vector& operator=(inlined_vector&& other) {
-		inlined_ = other.inlined_;
-		size_ = other.size_;
-		data_internal_ = std::move(other.data_internal_);
-		data_external_ = std::move(other.data_external_);
-		other.inlined_ = true;
-		other.size_ = 0;
-		return *this;
+	template <typename U> inline void push_front(U&& value) {
+		emplace_front(std::forward<U>(value));
 	}
 
-	inlined_vector& operator=(const inlined_vector& other) {
-		inlined_ = other.inlined_;
-		size_ = other.size_;
-		data_internal_ = other.data_internal_;
-		data_external_ = other.data_external_;
-		return *this;
+	// When growing, the new element is constructed before the old ones
+	// move, as args may refer to one of them
+	template<class... Args> void emplace_back(Args&&... args) {
+		if (size_ < capacity_) {
+			new (buffer() + physical(size_)) T(std::forward<Args>(args)...);
+		}
+		else if (!CanExpand) {
+			detail::report_error("inlined_deque::emplace_back exceeded Capacity");
+			return;
+		}
+		else {
+			const size_type capacity = next_capacity();
+			T* data = allocate(capacity);
+			new (data + size_) T(std::forward<Args>(args)...);
+			relocate_to(data, capacity);
+		}
+		++size_;
 	}
 
-	template<class Container> void extend(const Container& other) {
-		for (auto v : other) {
-			push_back(std::move(v));
+	template<class... Args> void emplace_front(Args&&... args) {
+		if (size_ < capacity_) {
+			const size_type head = head_ == 0 ? capacity_ - 1 : head_ - 1;
+			new (buffer() + head) T(std::forward<Args>(args)...);
+			head_ = head;
 		}
+		else if (!CanExpand) {
+			detail::report_error("inlined_deque::emplace_front exceeded Capacity");
+			return;
+		}
+		else {
+			const size_type capacity = next_capacity();
+			T* data = allocate(capacity);
+			new (data + capacity - 1) T(std::forward<Args>(args)...);
+			relocate_to(data, capacity);
+			head_ = capacity - 1;
+		}
+		++size_;
 	}
 
-	void extend(std::initializer_list<T> other) {
-		for (auto v : other) {
-			push_back(std::move(v));
+	void pop_back() {
+		if (size_ > 0) {
+			back().~T();
+			--size_;
 		}
 	}
 
-	inline virtual bool can_expand() const override final { return true; }
+	void pop_front() {
+		if (size_ > 0) {
+			front().~T();
+			head_ = head_ + 1 == capacity_ ? 0 : head_ + 1;
+			--size_;
+		}
+	}
 
-	inline void clear() {
-		if (!inlined_) {
-			inlined_ = false;
-			data_external_.clear();
+	// Destroys the elements but keeps any heap storage
+	void clear() {
+		for_each_segment([](T* data, size_type count) {
+			for (size_type i = 0; i < count; ++i) {
+				data[i].~T();
+			}
+		});
+		size_ = 0;
+		head_ = 0;
+	}
+
+protected:
+	raw_type inline_[Capacity];
+	T* heap_ = nullptr; // The heap ring, or nullptr while inline
+	size_type capacity_ = Capacity;
+	size_type head_ = 0;
+	size_type size_ = 0;
+
+	inline T* buffer() { return heap_ ? heap_ : reinterpret_cast<T*>(inline_); }
+	inline const T* buffer() const { return heap_ ? heap_ : reinterpret_cast<const T*>(inline_); }
+
+	// Wraps without a division, as i < capacity_
+	inline size_type physical(size_type i) const {
+		const size_type index = head_ + i;
+		return index >= capacity_ ? index - capacity_ : index;
+	}
+
+	template<class Self, class F> static void visit_segments(Self* self, F& f) {
+		const size_type first = std::min(self->size_, self->capacity_ - self->head_);
+		if (first > 0) {
+			f(self->buffer() + self->head_, first);
+		}
+		if (self->size_ > first) {
+			f(self->buffer(), self->size_ - first);
 		}
-		base_t::clear();
 	}
 
-	inline bool expanded() const final override { return !inlined_; }
+	inline size_type next_capacity() const { return 2 * capacity_; }
 
-	template <typename U>
-	inline void push_back(U&& value) {
-		if (inlined_ && size_ >= max_size()) {
-			grow_to_external_storage();
+	static T* allocate(size_type count) { return std::allocator<T>().allocate(count); }
+
+	// Moves the elements to the start of data and adopts it as the heap ring
+	void relocate_to(T* data, size_type capacity) {
+		T* old = buffer();
+		const size_type first = std::min(size_, capacity_ - head_);
+		detail::relocate_n(old + head_, first, data);
+		detail::relocate_n(old, size_ - first, data + first);
+		release();
+		heap_ = data;
+		capacity_ = capacity;
+		head_ = 0;
+	}
+
+	// Frees the heap ring, the elements must already be destroyed
+	void release() {
+		if (heap_) {
+			std::allocator<T>().deallocate(heap_, capacity_);
+			heap_ = nullptr;
+			capacity_ = Capacity;
 		}
+	}
 
-		if (inlined_) {
-			base_t::push_back(std::forward<U>(value));
+	// Steals other's heap ring or moves its inline elements
+	void take(inlined_deque& other) {
+		if (other.heap_) {
+			heap_ = other.heap_;
+			capacity_ = other.capacity_;
+			head_ = other.head_;
+			other.heap_ = nullptr;
+			other.capacity_ = Capacity;
 		}
 		else {
-			data_external_.push_back(std::forward<U>(value));
-			size_++;
+			T* dest = reinterpret_cast<T*>(inline_);
+			other.for_each_segment([&](T* data, size_type count) {
+				detail::relocate_n(data, count, dest);
+				dest += count;
+			});
+			head_ = 0;
+		}
+		size_ = other.size_;
+		other.size_ = 0;
+		other.head_ = 0;
+	}
+};
+
+template<typename T, int Capacity, bool CanExpand> inline void swap(inlined_deque<T, Capacity, CanExpand>& a, inlined_deque<T, Capacity, CanExpand>& b) {
+	a.swap(b);
+}
+
+// A priority queue of up to Capacity elements in an inlined_vector, kept as
+// a 4-ary heap, which is shallower than a binary heap and compares siblings
+// that share a cache line. As with std::priority_queue, top() is the largest
+// element by Compare.
+template<typename T, int Capacity, class Compare = std::less<T>, bool CanExpand = false>
+class inlined_priority_queue : private detail::ebo_holder<Compare> {
+public:
+	using value_type      = T;
+	using size_type       = std::size_t;
+	using reference       = T&;
+	using const_reference = const T&;
+	using value_compare   = Compare;
+	using container_type  = inlined_vector<T, Capacity, CanExpand>;
+
+	static constexpr size_type arity = 4;
+
+public:
+	inlined_priority_queue() = default;
+
+	explicit inlined_priority_queue(const Compare& compare) : compare_holder(compare) {}
+
+	inline bool empty() const { return elements_.empty(); }
+	inline bool full() const { return elements_.size() >= size_type(Capacity); }
+	inline size_type size() const { return elements_.size(); }
+	inline size_type capacity() const { return elements_.capacity(); }
+	inline void reserve(size_type count) { elements_.reserve(count); }
+	inline void clear() { elements_.clear(); }
+
+	// The elements in heap order
+	const container_type& elements() const { return elements_; }
+
+	inline const_reference top() const { return elements_.front(); }
+
+	inline void push(const T& value) { emplace(value); }
+	inline void push(T&& value) { emplace(std::move(value)); }
+
+	template<class... Args> void emplace(Args&&... args) {
+		const size_type size = elements_.size();
+		elements_.emplace_back(std::forward<Args>(args)...);
+		if (elements_.size() > size) {
+			sift_up(size, std::move(elements_.back()));
 		}
 	}
 
-	template<class... Args> inline void emplace_back(Args&&... args) {
-		if (inlined_ && size_ >= max_size()) {
-			grow_to_external_storage();
+	void pop() {
+		if (elements_.size() > 1) {
+			T value(std::move(elements_.back()));
+			elements_.pop_back();
+			sift_down(0, std::move(value));
+		}
+		else {
+			elements_.pop_back();
 		}
+	}
 
-		if (inlined_) {
-			base_t::emplace_back(std::forward<Args>(args)...);
+	// Pops the top and pushes value with a single sift
+	void replace_top(T value) {
+		if (empty()) {
+			elements_.push_back(std::move(value));
 		}
 		else {
-			data_external_.emplace_back(std::forward<Args>(args)...);
-			size_++;
+			sift_down(0, std::move(value));
 		}
 	}
 
-	inline void pop_back() override final {
-		if (!empty()){
-			if (inlined_) data_external_.pop_back();
-			size_--;
+	// Keeps the Capacity smallest elements by Compare without spilling: once
+	// full, value replaces the top if it is smaller and is dropped otherwise.
+	// The top is then the largest element kept, so use std::greater to keep
+	// the Capacity largest. Returns whether value was kept.
+	bool offer(T value) {
+		if (!full()) {
+			push(std::move(value));
+			return true;
 		}
+		if (less(value, top())) {
+			sift_down(0, std::move(value));
+			return true;
+		}
+		return false;
 	}
 
-	iterator begin() override final {
-		return inlined_ ? data_internal_.begin() : unwrap(data_external_.begin());
+	// Empties the queue, returning its elements sorted ascending by Compare
+	container_type take_sorted() {
+		container_type sorted(std::move(elements_));
+		elements_.clear();
+		std::sort(sorted.begin(), sorted.end(), value_comp());
+		return sorted;
 	}
-	const_iterator begin() const override final {
-		return inlined_ ? data_internal_.begin() : unwrap(data_external_.begin());
+
+	value_compare value_comp() const { return this->get(); }
+
+	void swap(inlined_priority_queue& other) {
+		using std::swap;
+		elements_.swap(other.elements_);
+		swap(this->get(), other.get());
 	}
-	reverse_iterator rend() override final {
-		return inlined_ ? data_internal_.rend() : unwrap(data_external_.rend());
+
+protected:
+	using compare_holder = detail::ebo_holder<Compare>;
+
+	container_type elements_;
+
+	inline bool less(const T& a, const T& b) const { return this->get()(a, b); }
+
+	// Moves parents down into the hole at index until value fits
+	void sift_up(size_type index, T&& value) {
+		T moved(std::move(value));
+		T* data = elements_.begin();
+		while (index > 0) {
+			const size_type parent = (index - 1) / arity;
+			if (!less(data[parent], moved)) {
+				break;
+			}
+			data[index] = std::move(data[parent]);
+			index = parent;
+		}
+		data[index] = std::move(moved);
 	}
-	const_reverse_iterator rend() const override final {
-		return inlined_ ? data_internal_.rend() : unwrap(data_external_.rend());
+
+	// Moves the largest children up into the hole at index until value fits
+	void sift_down(size_type index, T&& value) {
+		T moved(std::move(value));
+		T* data = elements_.begin();
+		const size_type size = elements_.size();
+		for (;;) {
+			const size_type first = arity * index + 1;
+			if (first >= size) {
+				break;
+			}
+			const size_type last = std::min(first + arity, size);
+			size_type largest = first;
+			for (size_type child = first + 1; child < last; ++child) {
+				if (less(data[largest], data[child])) {
+					largest = child;
+				}
+			}
+			if (!less(moved, data[largest])) {
+				break;
+			}
+			data[index] = std::move(data[largest]);
+			index = largest;
+		}
+		data[index] = std::move(moved);
 	}
+};
 
-	iterator erase(const_iterator it) {
-		base_t::validate_iterator(it);
+template<typename T, int Capacity, class Compare, bool CanExpand> constexpr typename inlined_priority_queue<T, Capacity, Compare, CanExpand>::size_type inlined_priority_queue<T, Capacity, Compare, CanExpand>::arity;
 
-		if (it == end() || empty()) {
-			error("inlined_vector::erase it == end or container is empty");
+template<typename T, int Capacity, class Compare, bool CanExpand>
+inline void swap(inlined_priority_queue<T, Capacity, Compare, CanExpand>& a, inlined_priority_queue<T, Capacity, Compare, CanExpand>& b) {
+	a.swap(b);
+}
+
+namespace detail {
+	// Per-thread cache of spill buffers in power-of-two size classes.
+	// Each block starts with a header naming the pool that allocated it, so a
+	// block freed on another thread is queued back to its owner. The pool is
+	// reference counted by its thread and by every block it has allocated, so
+	// it outlives its thread until the last of its blocks is freed.
+	class spill_pool {
+	public:
+		static constexpr int min_class = 6;	// 64 bytes
+		static constexpr int max_class = 20;	// 1 MiB, larger blocks aren't cached
+		static constexpr int max_cached = 16;	// Per size class
+
+		static void* allocate(std::size_t bytes) {
+			const int size_class = size_class_for(bytes);
+			spill_pool* pool = size_class <= max_class ? local() : nullptr;
+			return pool ? pool->take(size_class) : new_block(nullptr, size_class, bytes);
 		}
 
-		if (inlined_) {
-			size_type i = base_t::iterator_index(it);
-			if (i == size_) {
-				error("inlined_vector::erase invalid iterator");
-				return end();
+		static void deallocate(void* data) {
+			header* block = header_of(data);
+			spill_pool* owner = block->owner;
+			if (!owner) {
+				delete_block(block);
 			}
-			for (size_type j = i; j < size_ - 1; j++) {
-				element(j) = std::move(element(j + 1));
+			else if (owner == current()) {
+				owner->give(block);
+			}
+			else {
+				owner->give_remote(block);
 			}
-			size_--;
-			return begin() + i;
 		}
-		else {
-			size_--;
-			auto vit = std::next(data_external_.cbegin(), std::distance(cbegin(), it));
-			return unwrap(data_external_.erase(vit));
+
+		// Frees the blocks cached by this thread
+		static void trim() {
+			if (spill_pool* pool = current()) {
+				pool->drain_remote();
+				pool->free_cached();
+			}
 		}
-	}
 
-	iterator insert(iterator it, const_reference value) {
-		base_t::validate_iterator(it);
+	private:
+		struct alignas(std::max_align_t) header {
+			spill_pool* owner;
+			int size_class;
+		};
+
+		struct thread_owner {
+			spill_pool* pool;
+			thread_owner() : pool(new spill_pool()) {}
+			~thread_owner() {
+				current() = nullptr;
+				exited() = true;
+				pool->orphan();
+			}
+		};
+
+		header* free_[max_class + 1] = {};
+		int cached_[max_class + 1] = {};
+		std::atomic<std::size_t> refs_ { 1 };
+		std::atomic<bool> remote_pending_ { false };
+		std::mutex remote_mutex_;
+		header* remote_ = nullptr;
+		bool orphaned_ = false;
+
+		static spill_pool*& current() {
+			static thread_local spill_pool* pool = nullptr;
+			return pool;
+		}
 
-		if (inlined_ && size_ < max_size()) {
-			return base_t::insert(it, value);
+		static bool& exited() {
+			static thread_local bool exited = false;
+			return exited;
 		}
-		else if (inlined_ && size_ >= max_size()) {
-			size_type index_ = base_t::iterator_index(it);
-			grow_to_external_storage();
-			it = std::next(begin(), index_);
+
+		// Null once this thread has started exiting, blocks then bypass the pool
+		static spill_pool* local() {
+			spill_pool*& pool = current();
+			if (!pool && !exited()) {
+				static thread_local thread_owner owner;
+				pool = owner.pool;
+			}
+			return pool;
 		}
 
-		if (it == end()) {
-			push_back(value);
-			return end();
+		static int size_class_for(std::size_t bytes) {
+			int size_class = min_class;
+			while (size_class <= max_class && (std::size_t(1) << size_class) < bytes) {
+				++size_class;
+			}
+			return size_class;
 		}
-		else {
-			size_++;
-			// NB: dataVector may not have a T* iterator
-			auto vit = std::next(data_external_.begin(), std::distance(begin(), it));
-			return unwrap(data_external_.insert(vit, value));
+
+		static header* header_of(void* data) {
+			return static_cast<header*>(data) - 1;
 		}
-	}
 
-protected:
-	std::vector<T> data_external_;
-	bool inlined_ = true;
+		// Free lists are threaded through the unused payloads
+		static header*& next(header* block) {
+			return *reinterpret_cast<header**>(block + 1);
+		}
 
-protected:
-	// Helper constructor
-	template<typename Iter> inlined_vector(Iter begin_, Iter end_, size_type size) {
-		size_ = size;
-		if (size_ <= max_size()) {
-			for (auto it = begin_; it != end_; ++it){
-				data_internal_.emplace_back(std::move(*it));
+		static void* new_block(spill_pool* owner, int size_class, std::size_t bytes = 0) {
+			const std::size_t payload = size_class <= max_class ? std::size_t(1) << size_class : bytes;
+			header* block = static_cast<header*>(::operator new(sizeof(header) + payload));
+			block->owner = owner;
+			block->size_class = size_class;
+			return block + 1;
+		}
+
+		static void delete_block(header* block) {
+			::operator delete(block);
+		}
+
+		void* take(int size_class) {
+			if (remote_pending_.load(std::memory_order_acquire)) {
+				drain_remote();
 			}
+			if (header* block = free_[size_class]) {
+				free_[size_class] = next(block);
+				--cached_[size_class];
+				return block + 1;
+			}
+			refs_.fetch_add(1, std::memory_order_relaxed);
+			return new_block(this, size_class);
 		}
-		else {
-			data_external_.resize(size_);
-			std::move(begin_, end_, data_external_.begin());
-			inlined_ = false;
+
+		void give(header* block) {
+			const int size_class = block->size_class;
+			if (cached_[size_class] < max_cached) {
+				next(block) = free_[size_class];
+				free_[size_class] = block;
+				++cached_[size_class];
+			}
+			else {
+				delete_block(block);
+				refs_.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+
+		void give_remote(header* block) {
+			bool dead = false;
+			{
+				std::lock_guard<std::mutex> lock(remote_mutex_);
+				if (orphaned_) {
+					delete_block(block);
+					dead = refs_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+				}
+				else {
+					next(block) = remote_;
+					remote_ = block;
+					remote_pending_.store(true, std::memory_order_release);
+				}
+			}
+			if (dead) {
+				delete this;
+			}
+		}
+
+		void drain_remote() {
+			header* blocks = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(remote_mutex_);
+				blocks = remote_;
+				remote_ = nullptr;
+				remote_pending_.store(false, std::memory_order_relaxed);
+			}
+			while (blocks) {
+				header* rest = next(blocks);
+				give(blocks);
+				blocks = rest;
+			}
+		}
+
+		void free_cached() {
+			for (int size_class = min_class; size_class <= max_class; ++size_class) {
+				while (header* block = free_[size_class]) {
+					free_[size_class] = next(block);
+					delete_block(block);
+					refs_.fetch_sub(1, std::memory_order_relaxed);
+				}
+				cached_[size_class] = 0;
+			}
+		}
+
+		// Called when the owning thread exits. Blocks queued before orphaned_
+		// is set are freed here, later ones by give_remote().
+		void orphan() {
+			free_cached();
+			bool dead = false;
+			{
+				std::lock_guard<std::mutex> lock(remote_mutex_);
+				orphaned_ = true;
+				std::size_t freed = 0;
+				for (header* block = remote_; block; ++freed) {
+					header* rest = next(block);
+					delete_block(block);
+					block = rest;
+				}
+				remote_ = nullptr;
+				remote_pending_.store(false, std::memory_order_relaxed);
+				dead = refs_.fetch_sub(freed + 1, std::memory_order_acq_rel) == freed + 1;
+			}
+			if (dead) {
+				delete this;
+			}
 		}
+	};
+}
+
+// Allocates spill buffers from a thread-local pool of recycled blocks.
+// Any thread may free a block, so all instances compare equal.
+template<typename T> struct pooled_allocator {
+	static_assert(alignof(T) <= alignof(std::max_align_t), "pooled_allocator doesn't support over-aligned types");
+
+	using value_type = T;
+	using propagate_on_container_move_assignment = std::true_type;
+	using is_always_equal = std::true_type;
+
+	pooled_allocator() = default;
+	template<typename U> pooled_allocator(const pooled_allocator<U>&) {}
+
+	T* allocate(std::size_t count) {
+		return static_cast<T*>(detail::spill_pool::allocate(count * sizeof(T)));
 	}
 
-	// Sometimes std::vector<T>::iterator isn't a T* (e.g., in clang/libcxx)
-	// so we need to unwrap the iterator
-	inline iterator unwrap(typename std::vector<T>::iterator it) const { return &*it; }
-	inline const_iterator unwrap(typename std::vector<T>::const_iterator it) const { return &*it; }
-	inline reverse_iterator unwrap(typename std::vector<T>::reverse_iterator it) const {
-		return reverse_iterator(&*it);
+	void deallocate(T* data, std::size_t) {
+		detail::spill_pool::deallocate(data);
 	}
-	inline const_reverse_iterator unwrap(typename std::vector<T>::const_reverse_iterator it) const {
-		return const_reverse_iterator(&*it);
+
+	// Frees the blocks cached by the calling thread
+	static void trim() { detail::spill_pool::trim(); }
+
+	template<typename U> bool operator==(const pooled_allocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const pooled_allocator<U>&) const { return false; }
+};
+
+// An expandable inlined_vector that fills Lines cache lines, with its size
+// in the first line alongside the first elements
+template<typename T, std::size_t Lines, class Policy = default_inlined_vector_policy, std::size_t LineSize = 64>
+using cache_line_inlined_vector = inlined_vector<T, cache_line_capacity<T, Lines, LineSize, Policy::track_high_water ? 2 : 1>::value, true, cache_line_layout<LineSize, Policy>>;
+
+// An inlined_vector whose inline and heap storage start on an Alignment
+// boundary, for aligned SIMD loads
+template<typename T, int Capacity, std::size_t Alignment, bool CanExpand = false, class Policy = default_inlined_vector_policy>
+using aligned_inlined_vector = inlined_vector<T, Capacity, CanExpand, Policy, std::allocator<T>, Alignment>;
+
+// An expandable inlined_vector whose copies share spilled storage until written
+template<typename T, int Capacity, class Policy = default_inlined_vector_policy, class Allocator = std::allocator<T>>
+using cow_inlined_vector = inlined_vector<T, Capacity, true, copy_on_write_policy<Policy>, Allocator>;
+
+// An expandable inlined_vector that recycles its spill buffers through a thread-local pool
+template<typename T, int Capacity, class Policy = default_inlined_vector_policy>
+using pooled_inlined_vector = inlined_vector<T, Capacity, true, Policy, pooled_allocator<T>>;
+
+// A monotonic arena for scratch vectors. Allocation bumps a pointer through
+// a list of chunks, individual frees do nothing and reset() reclaims
+// everything at once, keeping the chunks for reuse.
+class spill_arena {
+public:
+	explicit spill_arena(std::size_t chunk_size = 64 * 1024) : chunk_size_(chunk_size) {}
+	spill_arena(const spill_arena&) = delete;
+	spill_arena& operator=(const spill_arena&) = delete;
+
+	~spill_arena() {
+		release();
 	}
 
-	void grow_to_external_storage() {
-		assert(inlined_);
-		data_internal_.emplace_into(data_external_);
-		inlined_ = false;
+	void* allocate(std::size_t bytes, std::size_t alignment) {
+		if (!current_ || !fits(current_, bytes, alignment)) {
+			next_chunk(bytes + alignment);
+		}
+		const std::size_t offset = aligned_offset(current_, alignment);
+		current_->used = offset + bytes;
+		return data(current_) + offset;
 	}
 
-	template<typename T2, int N>
-	friend std::ostream& operator<<(std::ostream& out, const inlined_vector<T2, N, true>& vector);
-};
+	// Makes all chunks available again, invalidating every allocation
+	void reset() {
+		for (chunk* c = head_; c; c = c->next) {
+			c->used = 0;
+		}
+		current_ = head_;
+	}
 
-template<typename T, int N>
-inline std::ostream& operator<<(std::ostream& out, const inlined_vector<T, N, false>& vector) {
-	out << "inlined_vector ";
-	out << "(inlined):  [";
-	if (vector.empty())
-		out << "]";
-	else {
-		for (auto it = vector.begin(); it != vector.end(); ++it) {
-			if (std::next(it) != vector.end())
-				out << *it << ", ";
-			else
-				out << *it << "]";
+	// Frees all chunks
+	void release() {
+		while (head_) {
+			chunk* next = head_->next;
+			::operator delete(head_);
+			head_ = next;
 		}
+		current_ = nullptr;
 	}
-	return out;
-}
 
-template<typename T, int N>
-inline std::ostream& operator<<(std::ostream& out, const inlined_vector<T, N, true>& vector) {
-	out << "inlined_vector ";
-	if (vector.inlined_)
-		out << "(inlined):  [";
-	else
-		out << "(external): [";
-	if (vector.empty())
-		out << "]";
-	else {
-		for (auto it = vector.begin(); it != vector.end(); ++it) {
-			if (std::next(it) != vector.end())
-				out << *it << ", ";
-			else
-				out << *it << "]";
+	std::size_t bytes_used() const {
+		std::size_t used = 0;
+		for (chunk* c = head_; c; c = c->next) {
+			used += c->used;
 		}
+		return used;
 	}
-	return out;
+
+private:
+	struct alignas(std::max_align_t) chunk {
+		chunk* next;
+		std::size_t size;
+		std::size_t used;
+	};
+
+	chunk* head_ = nullptr;
+	chunk* current_ = nullptr;
+	std::size_t chunk_size_;
+
+	static char* data(chunk* c) {
+		return reinterpret_cast<char*>(c + 1);
+	}
+
+	static std::size_t aligned_offset(chunk* c, std::size_t alignment) {
+		const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(data(c)) + c->used;
+		return c->used + ((alignment - address % alignment) % alignment);
+	}
+
+	static bool fits(chunk* c, std::size_t bytes, std::size_t alignment) {
+		return aligned_offset(c, alignment) + bytes <= c->size;
+	}
+
+	// Moves to the next chunk after current, allocating one if it's too small
+	void next_chunk(std::size_t bytes) {
+		chunk* next = current_ ? current_->next : head_;
+		if (!next || next->size < bytes) {
+			const std::size_t size = std::max(chunk_size_, bytes);
+			chunk* fresh = static_cast<chunk*>(::operator new(sizeof(chunk) + size));
+			fresh->size = size;
+			fresh->used = 0;
+			fresh->next = next;
+			if (current_) {
+				current_->next = fresh;
+			}
+			else {
+				head_ = fresh;
+			}
+			next = fresh;
+		}
+		current_ = next;
+	}
+};
+
+// Allocates spill buffers from a spill_arena and never frees them
+template<typename T> struct arena_allocator {
+	using value_type = T;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	spill_arena* arena;
+
+	arena_allocator(spill_arena& arena_) : arena(&arena_) {}
+	template<typename U> arena_allocator(const arena_allocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(std::size_t count) {
+		return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, std::size_t) {}
+
+	template<typename U> bool operator==(const arena_allocator<U>& other) const { return arena == other.arena; }
+	template<typename U> bool operator!=(const arena_allocator<U>& other) const { return arena != other.arena; }
+};
+
+// An expandable inlined_vector that spills into a spill_arena, construct it
+// with the arena. Elements are still destroyed but the storage is only
+// reclaimed when the arena is reset.
+template<typename T, int Capacity, class Policy = default_inlined_vector_policy>
+using arena_inlined_vector = inlined_vector<T, Capacity, true, Policy, arena_allocator<T>>;
+
+#ifdef BSP_INLINED_VECTOR_HAS_PMR
+namespace pmr {
+	// An expandable inlined_vector that spills into a std::pmr::memory_resource
+	template<typename T, int Capacity, class Policy = default_inlined_vector_policy>
+	using inlined_vector = bsp::inlined_vector<T, Capacity, true, Policy, std::pmr::polymorphic_allocator<T>>;
 }
+#endif
 } // namespace bsp
 
 #endif
\ No newline at end of file
@@ -1,15 +1,29 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <random>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
 #define BSP_INLINED_VECTOR_THROWS
 // #define BSP_INLINED_VECTOR_LOG_ERROR(message) std::cerr << message << "\n"
 #include "inlined_vector.h"
@@ -39,6 +53,8 @@ struct Counter {
     Counter(int* i):counter(i){ if (counter) (*counter)++; }
     Counter(const Counter& c){ counter = c.counter; if (counter) (*counter)++; };
     Counter(Counter&& c){ counter = c.counter; c.counter = nullptr; };
+    Counter& operator=(const Counter& c){ if (counter) (*counter)--; counter = c.counter; if (counter) (*counter)++; return *this; }
+    Counter& operator=(Counter&& c){ if (counter) (*counter)--; counter = c.counter; c.counter = nullptr; return *this; }
     ~Counter(){ if (counter) (*counter)--; }
 };
 
@@ -102,6 +118,62 @@ TEST_CASE("sizeof", "[inlined_vector]") {
     CHECK(sizeof(v1) < sizeof(v2));
 }
 
+TEST_CASE("compact size", "[inlined_vector]") {
+    static_assert(sizeof(inlined_vector<std::uint8_t, 7>) == 8, "size counter isn't compact");
+    static_assert(sizeof(inlined_vector<std::uint8_t, 255>) == 256, "size counter isn't compact");
+    static_assert(sizeof(inlined_vector<std::uint8_t, 256>) == 258, "size counter isn't compact");
+    static_assert(sizeof(inlined_vector<std::uint16_t, 1000>) == 2002, "size counter isn't compact");
+
+    inlined_vector<std::uint8_t, 255> v;
+    for (int i=0; i<255; i++) v.push_back(static_cast<std::uint8_t>(i));
+    CHECK(v.size() == 255);
+    CHECK(v.full());
+    CHECK(v.back() == 254);
+}
+
+TEST_CASE("element lifetimes", "[inlined_vector]") {
+    int counter = 0;
+    inlined_vector<Counter, 4> v;
+    for (int i=0; i<4; i++) v.emplace_back(&counter);
+    CHECK(counter == 4);
+
+    v.pop_back();
+    CHECK(counter == 3);
+
+    v.erase(v.begin());
+    CHECK(counter == 2);
+
+    v.clear();
+    CHECK(counter == 0);
+    CHECK(v.empty());
+
+    // The storage is reusable after clear
+    for (int i=0; i<4; i++) v.emplace_back(&counter);
+    CHECK(counter == 4);
+    CHECK(v.full());
+}
+
+// The expandable vector's inline buffer doubles as its heap pointer and
+// capacity, and the spill flag shares the size's word
+template<typename T, int N> constexpr std::size_t expandable_size_budget() {
+    return (N * sizeof(T) > 2 * sizeof(void*) ? N * sizeof(T) : 2 * sizeof(void*)) + sizeof(std::size_t);
+}
+
+// The capacity profiler adds a high water mark to each vector
+#ifndef BSP_INLINED_VECTOR_PROFILE
+static_assert(sizeof(inlined_vector<int, 16, true>) <= expandable_size_budget<int, 16>(), "size budget exceeded");
+static_assert(sizeof(inlined_vector<char, 4, true>) <= expandable_size_budget<char, 4>(), "size budget exceeded");
+static_assert(sizeof(inlined_vector<double, 64, true>) <= expandable_size_budget<double, 64>(), "size budget exceeded");
+static_assert(sizeof(inlined_vector<std::string, 8, true>) <= expandable_size_budget<std::string, 8>(), "size budget exceeded");
+static_assert(sizeof(inlined_vector<char, 4, true>) == 2 * sizeof(void*) + sizeof(std::size_t), "header is larger than one word");
+#endif
+
+TEST_CASE("static dispatch", "[inlined_vector]") {
+    static_assert(!std::is_polymorphic<inlined_vector<int, 16, false>>::value, "inlined_vector has a vtable");
+    static_assert(!std::is_polymorphic<inlined_vector<int, 16, true>>::value, "inlined_vector has a vtable");
+    CHECK(sizeof(inlined_vector<int, 16, false>) == sizeof(static_vector<int, 16>));
+}
+
 TEST_CASE("operator<<", "[inlined_vector]") {
     std::cout << "Testing output...\n";
     inlined_vector<int, 16, false> v1 { 1, 2, 3, 4, 5 };
@@ -470,6 +542,399 @@ TEST_CASE("emplacement", "[inlined_vector]") {
     }
 }
 
+TEST_CASE("bulk insertion", "[inlined_vector]"){
+    std::vector<int> source { 10, 11, 12, 13, 14 };
+
+    SECTION("insert range"){
+        inlined_vector<int, 16, false> v { 1, 2, 3 };
+        auto it = v.insert(std::next(v.begin()), source.begin(), source.end());
+        CHECK(*it == 10);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 10, 11, 12, 13, 14, 2, 3 }));
+    }
+
+    SECTION("insert range (expandable)"){
+        inlined_vector<int, 4, true> v { 1, 2, 3 };
+        auto it = v.insert(std::next(v.begin()), source.begin(), source.end());
+        CHECK(*it == 10);
+        CHECK(v.expanded());
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 10, 11, 12, 13, 14, 2, 3 }));
+    }
+
+    SECTION("insert copies"){
+        inlined_vector<std::string, 4, true> v { "a", "b" };
+        v.insert(v.begin(), 3, "c");
+        v.insert(v.end(), 2, v[0]);
+        CHECK_THAT(v, Equals(v, std::vector<std::string> { "c", "c", "c", "a", "b", "c", "c" }));
+    }
+
+    SECTION("insert initializer_list"){
+        inlined_vector<int, 8, false> v { 1, 2 };
+        v.insert(v.end(), { 3, 4 });
+        v.insert(v.begin(), { -1, 0 });
+        CHECK_THAT(v, Equals(v, std::vector<int> { -1, 0, 1, 2, 3, 4 }));
+    }
+
+    SECTION("insert single pass range"){
+        std::istringstream stream("7 8 9");
+        inlined_vector<int, 4, true> v { 1, 2, 3 };
+        v.insert(std::next(v.begin()), std::istream_iterator<int>(stream), std::istream_iterator<int>());
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 7, 8, 9, 2, 3 }));
+    }
+
+    SECTION("spills once"){
+        inlined_vector<int, 8, true> v { 1, 2, 3, 4, 5 };
+        std::vector<int> many (100, 42);
+        v.append(many.begin(), many.end());
+        CHECK(v.size() == 105);
+        CHECK(v.capacity() == 105);
+        CHECK(v[4] == 5);
+        CHECK(v[5] == 42);
+    }
+
+    SECTION("append moved elements"){
+        inlined_vector<MoveOnly, 2, true> source2;
+        for (int i=0; i<4; i++) source2.emplace_back(i);
+        inlined_vector<MoveOnly, 2, true> v;
+        v.append(std::make_move_iterator(source2.begin()), std::make_move_iterator(source2.end()));
+        REQUIRE(v.size() == 4);
+        CHECK(v[3].value == 3);
+        CHECK(source2[3].value == 0);
+    }
+
+    SECTION("assign"){
+        inlined_vector<int, 4, true> v { 1, 2, 3 };
+        v.assign(source.begin(), source.end());
+        CHECK_THAT(v, Equals(v, source));
+        v.assign(2, 7);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 7, 7 }));
+        v.assign({ 1, 2 });
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 2 }));
+
+        inlined_vector<int, 8, false> v2;
+        v2.assign(source.begin(), source.end());
+        CHECK_THAT(v2, Equals(v2, source));
+    }
+
+    SECTION("element lifetimes"){
+        int counter = 0;
+        {
+            std::vector<Counter> counters (6, Counter(&counter));
+            inlined_vector<Counter, 4, true> v;
+            v.emplace_back(&counter);
+            v.insert(v.begin(), counters.begin(), counters.end());
+            CHECK(counter == 13);
+            v.assign(2, Counter(&counter));
+            CHECK(counter == 8);
+        }
+        CHECK(counter == 0);
+    }
+
+#ifdef BSP_INLINED_VECTOR_THROWS
+    SECTION("too many elements"){
+        inlined_vector<int, 4, false> v { 1, 2 };
+        CHECK_THROWS(v.insert(v.begin(), source.begin(), source.end()));
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 2 }));
+    }
+#endif
+}
+
+TEST_CASE("unchecked and non-throwing appends", "[inlined_vector]"){
+    SECTION("unchecked"){
+        inlined_vector<int, 8, false> v;
+        for (int i=0; i<8; i++) v.push_back_unchecked(i);
+        v.pop_back();
+        v.emplace_back_unchecked(42);
+        CHECK(v.size() == 8);
+        CHECK(v.back() == 42);
+    }
+
+    SECTION("unchecked (expandable)"){
+        inlined_vector<int, 8, true> v;
+        v.reserve(100);
+        for (int i=0; i<100; i++) v.push_back_unchecked(i);
+        CHECK(v.size() == 100);
+        CHECK(v.back() == 99);
+    }
+
+    SECTION("try"){
+        inlined_vector<std::string, 2, false> v;
+        std::string* first = v.try_push_back("a");
+        REQUIRE(first);
+        CHECK(*first == "a");
+        CHECK(v.try_emplace_back(3, 'b'));
+        CHECK(v.try_push_back("c") == nullptr);
+        CHECK_THAT(v, Equals(v, std::vector<std::string> { "a", "bbb" }));
+    }
+
+    SECTION("try (expandable) doesn't allocate"){
+        inlined_vector<int, 2, true> v;
+        CHECK(*v.try_push_back(1) == 1);
+        CHECK(*v.try_emplace_back(2) == 2);
+        CHECK(v.try_push_back(3) == nullptr);
+        CHECK(!v.expanded());
+        v.reserve(3);
+        CHECK(*v.try_push_back(3) == 3);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 2, 3 }));
+    }
+}
+
+TEST_CASE("range erase", "[inlined_vector]"){
+    SECTION("middle"){
+        inlined_vector<int, 8, false> v { 1, 2, 3, 4, 5, 6 };
+        auto it = v.erase(std::next(v.begin(), 1), std::next(v.begin(), 4));
+        CHECK(*it == 5);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 5, 6 }));
+    }
+
+    SECTION("everything (expandable)"){
+        inlined_vector<std::string, 2, true> v { "a", "b", "c", "d" };
+        auto it = v.erase(v.begin(), v.end());
+        CHECK(it == v.end());
+        CHECK(v.empty());
+    }
+
+    SECTION("empty range"){
+        inlined_vector<int, 8, true> v { 1, 2, 3 };
+        auto it = v.erase(std::next(v.begin()), std::next(v.begin()));
+        CHECK(*it == 2);
+        CHECK(v.size() == 3);
+    }
+
+    SECTION("element lifetimes"){
+        int counter = 0;
+        inlined_vector<Counter, 4, true> v;
+        for (int i=0; i<10; i++) v.emplace_back(&counter);
+        v.erase(std::next(v.begin(), 2), std::next(v.begin(), 7));
+        CHECK(v.size() == 5);
+        CHECK(counter == 5);
+    }
+}
+
+TEST_CASE("resize", "[inlined_vector]"){
+    SECTION("fixed"){
+        inlined_vector<int, 8, false> v { 1, 2, 3 };
+        v.resize(5);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 2, 3, 0, 0 }));
+        v.resize(7, 9);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 2, 3, 0, 0, 9, 9 }));
+        v.resize(2);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 2 }));
+#ifdef BSP_INLINED_VECTOR_THROWS
+        CHECK_THROWS(v.resize(9));
+#endif
+    }
+
+    SECTION("expandable"){
+        inlined_vector<int, 4, true> v { 1, 2 };
+        v.resize(3);
+        CHECK_FALSE(v.expanded());
+        v.resize(6, v[0]);
+        CHECK(v.expanded());
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1, 2, 0, 1, 1, 1 }));
+        v.resize(1);
+        CHECK_THAT(v, Equals(v, std::vector<int> { 1 }));
+    }
+
+    SECTION("default init"){
+        inlined_vector<std::uint8_t, 64, true> v;
+        v.resize_default_init(4096);
+        CHECK(v.size() == 4096);
+        std::fill(v.begin(), v.end(), std::uint8_t(7));
+        v.resize_default_init(10);
+        CHECK(v.size() == 10);
+        CHECK(v[9] == 7);
+
+        inlined_vector<std::string, 2, true> strings;
+        strings.resize_default_init(3);
+        CHECK(strings[2].empty());
+    }
+
+    SECTION("count constructors"){
+        inlined_vector<int, 4, true> v (6);
+        CHECK_THAT(v, Equals(v, std::vector<int> (6, 0)));
+        inlined_vector<int, 4, false> fixed (3);
+        CHECK_THAT(fixed, Equals(fixed, std::vector<int> (3, 0)));
+        inlined_vector<int, 4, false> filled (3, 7);
+        CHECK_THAT(filled, Equals(filled, std::vector<int> (3, 7)));
+    }
+
+    SECTION("element lifetimes"){
+        int counter = 0;
+        {
+            inlined_vector<Counter, 2, true> v;
+            v.resize(5, Counter(&counter));
+            CHECK(counter == 5);
+            v.resize(1);
+            CHECK(counter == 1);
+            v.resize(3);
+            CHECK(counter == 1);
+        }
+        CHECK(counter == 0);
+    }
+}
+
+TEST_CASE("shrink_to_fit", "[inlined_vector]"){
+    SECTION("returns inline"){
+        int counter = 0;
+        {
+            inlined_vector<Counter, 4, true> v;
+            for (int i=0; i<100; i++) v.emplace_back(&counter);
+            CHECK(v.expanded());
+            while (v.size() > 3) v.pop_back();
+            v.shrink_to_fit();
+            CHECK(!v.expanded());
+            CHECK(v.capacity() == 4);
+            CHECK(counter == 3);
+        }
+        CHECK(counter == 0);
+    }
+
+    SECTION("returns inline after clear"){
+        inlined_vector<std::string, 4, true> v (10, "spilled");
+        v.clear();
+        v.shrink_to_fit();
+        CHECK(!v.expanded());
+        v.push_back("inline");
+        CHECK(v.front() == "inline");
+    }
+
+    SECTION("trims the heap storage"){
+        inlined_vector<int, 4, true> v (8, 42);
+        v.reserve(64);
+        v.shrink_to_fit();
+        CHECK(v.expanded());
+        CHECK(v.capacity() == 8);
+        CHECK_THAT(v, Equals(v, std::vector<int>(8, 42)));
+    }
+
+    SECTION("hysteresis"){
+        inlined_vector<int, 8, true, bsp::shrink_hysteresis<1, 2>> v (16, 42);
+        while (v.size() > 5) v.pop_back();
+        v.shrink_to_fit();
+        CHECK(v.expanded());
+        v.pop_back();
+        v.shrink_to_fit();
+        CHECK(!v.expanded());
+        CHECK_THAT(v, Equals(v, std::vector<int>(4, 42)));
+    }
+
+    SECTION("inlined is a no-op"){
+        inlined_vector<int, 4, true> v { 1, 2 };
+        v.shrink_to_fit();
+        CHECK(!v.expanded());
+        inlined_vector<int, 4, false> v2 { 1, 2 };
+        v2.shrink_to_fit();
+        CHECK(v2.size() == 2);
+    }
+}
+
+struct StatsTag {};
+
+TEST_CASE("spill statistics", "[inlined_vector]"){
+    using Vector = inlined_vector<int, 4, true, bsp::counting_policy<>>;
+    using Other = inlined_vector<StatsTag*, 4, true, bsp::counting_policy<>>;
+    // Other tests share Vector's counters when BSP_INLINED_VECTOR_STATS is on
+    const auto total = bsp::inlined_vector_stats::total();
+    const auto initial = bsp::inlined_vector_stats::of<Vector>();
+    {
+        Vector v { 1, 2, 3 };
+        CHECK(bsp::inlined_vector_stats::of<Vector>().spills == initial.spills);
+        v.push_back(4);
+        v.push_back(5);
+        auto stats = bsp::inlined_vector_stats::of<Vector>();
+        CHECK(stats.spills - initial.spills == 1);
+        CHECK(stats.elements_moved - initial.elements_moved == 4);
+        CHECK(stats.heap_bytes - initial.heap_bytes == v.capacity() * sizeof(int));
+        for (int i=0; i<100; i++) v.push_back(i);
+        stats = bsp::inlined_vector_stats::of<Vector>();
+        CHECK(stats.spills - initial.spills == 1);
+        CHECK(stats.heap_bytes - initial.heap_bytes == v.capacity() * sizeof(int));
+        CHECK(stats.peak_heap_bytes >= stats.heap_bytes);
+
+        v.erase(v.begin() + 2, v.end());
+        v.shrink_to_fit();
+        stats = bsp::inlined_vector_stats::of<Vector>();
+        CHECK(stats.shrinks - initial.shrinks == 1);
+        CHECK(stats.heap_bytes == initial.heap_bytes);
+        CHECK(stats.peak_heap_bytes >= 128 * sizeof(int));
+
+        Other o (10);
+        CHECK(bsp::inlined_vector_stats::of<Other>().spills == 1);
+        CHECK(bsp::inlined_vector_stats::of<Other>().heap_bytes == 10 * sizeof(StatsTag*));
+    }
+    CHECK(bsp::inlined_vector_stats::of<Other>().heap_bytes == 0);
+
+    const auto after = bsp::inlined_vector_stats::total();
+    CHECK(after.spills - total.spills == 2);
+    CHECK(after.shrinks - total.shrinks == 1);
+    CHECK(after.heap_bytes == total.heap_bytes);
+
+    auto all = bsp::inlined_vector_stats::instantiations();
+    CHECK(std::count_if(all.begin(), all.end(), [](const bsp::inlined_vector_stats& stats){
+        return std::string(stats.name) == typeid(Vector).name() || std::string(stats.name) == typeid(Other).name();
+    }) == 2);
+
+    CHECK(sizeof(Vector) == sizeof(inlined_vector<int, 4, true, bsp::inlined_vector_policy>));
+}
+
+struct ProfiledTag {};
+
+TEST_CASE("capacity profiler", "[inlined_vector]"){
+    using Vector = inlined_vector<int, 16, true, bsp::capacity_profiler<ProfiledTag>>;
+    // 99 vectors peak at 5 elements and one at 100
+    for (int n=0; n<100; n++){
+        Vector v;
+        const int peak = n == 0 ? 100 : 5;
+        for (int i=0; i<peak; i++) v.push_back(i);
+        while (v.size() > 2) v.pop_back();
+    }
+    {
+        Vector v { 1, 2, 3, 4, 5, 6, 7, 8 };
+        v.erase(v.begin(), v.end());
+        Vector moved = std::move(v);
+    }
+
+    std::ostringstream report;
+    bsp::report_capacity_profile(report, 0.9);
+    const std::string text = report.str();
+    const auto at = text.find(typeid(ProfiledTag).name());
+    REQUIRE(at != std::string::npos);
+    const std::string profile = text.substr(at);
+    CHECK(profile.find("vectors: 102, capacity: 16, spilled: ") != std::string::npos);
+    CHECK(profile.find("size at destruction p50/p90: 2/2") != std::string::npos);
+    CHECK(profile.find("max size p50/p90: 5/5") != std::string::npos);
+    CHECK(profile.find("recommended capacity: 5, inline bytes per vector: 64 -> 20") != std::string::npos);
+
+    CHECK(bsp::detail::size_histogram::upper_bound(bsp::detail::size_histogram::bucket(100)) == 127);
+    CHECK(bsp::detail::size_histogram::upper_bound(bsp::detail::size_histogram::bucket(64)) == 127);
+    CHECK(bsp::detail::size_histogram::upper_bound(bsp::detail::size_histogram::bucket(63)) == 63);
+    CHECK(sizeof(Vector) == sizeof(inlined_vector<int, 16, true, bsp::inlined_vector_policy>) + sizeof(std::size_t));
+}
+
+struct ThreadedProfileTag {};
+
+TEST_CASE("capacity profiler merges samples from other threads", "[inlined_vector]"){
+    using Vector = inlined_vector<int, 4, true, bsp::capacity_profiler<ThreadedProfileTag>>;
+    // Fewer than a batch per thread, so only thread exit publishes them
+    std::vector<std::thread> threads;
+    for (int t=0; t<4; t++){
+        threads.emplace_back([]{
+            for (int n=0; n<100; n++){
+                Vector v;
+                for (int i=0; i<3; i++) v.push_back(i);
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    std::ostringstream report;
+    bsp::report_capacity_profile(report);
+    const std::string text = report.str();
+    const auto at = text.find(typeid(ThreadedProfileTag).name());
+    REQUIRE(at != std::string::npos);
+    CHECK(text.find("vectors: 400, capacity: 4, spilled: 0%", at) != std::string::npos);
+}
+
 #ifdef BSP_INLINED_VECTOR_THROWS
 TEST_CASE("exception reporting", "[inlined_vector]"){
     SECTION ("too many elements in std::vector"){
@@ -496,6 +961,12 @@ TEST_CASE("exception reporting", "[inlined_vector]"){
         CHECK_NOTHROW(v1.push_back(42));
         CHECK_THROWS(v1.push_back(666));
     }
+
+    SECTION ("reserve beyond capacity"){
+        inlined_vector<int, 4, false> v1;
+        CHECK_NOTHROW(v1.reserve(4));
+        CHECK_THROWS(v1.reserve(5));
+    }
 }
 #endif
 
@@ -559,70 +1030,1809 @@ TEST_CASE("moveability (expanded)", "[inlined_vector]"){
     }
 }
 
-TEST_CASE("assignment", "[inlined_vector]"){
-    inlined_vector<int, 4, false> v1 { 1, 2, 3, 4 };
-    inlined_vector<int, 4, true> v2 { 1, 2, 4, 8 };
-    inlined_vector<int, 8, false> v3 { 0, 1, 0, 1, 0, 1, 0, 1};
-    inlined_vector<int, 8, true> v4 { 42, 42, 42, 42, 42, 42, 42, 42 };
+TEST_CASE("spill flag", "[inlined_vector]"){
+    inlined_vector<int, 2, true> v;
+    for (int i=0; i<2; i++) v.push_back(i);
+    CHECK_FALSE(v.expanded());
+    v.push_back(2);
+    CHECK(v.expanded());
+    CHECK(v.size() == 3);
+    v.pop_back();
+    v.pop_back();
+    CHECK(v.size() == 1);
+    CHECK(v.expanded());
+    v.shrink_to_fit();
+    CHECK_FALSE(v.expanded());
+    CHECK(v.size() == 1);
+
+    inlined_vector<int, 2, true> a (5, 1), b { 1 };
+    a.swap(b);
+    CHECK(a.size() == 1);
+    CHECK_FALSE(a.expanded());
+    CHECK(b.size() == 5);
+    CHECK(b.expanded());
+    a = b;
+    CHECK(a.expanded());
+    CHECK(a.size() == 5);
+    b = inlined_vector<int, 2, true>();
+    CHECK_FALSE(b.expanded());
+    CHECK(b.empty());
+}
 
-    v1 = v2;
-    CHECK_THAT(v1, Equals(v1, v2));
+TEST_CASE("spilling", "[inlined_vector]"){
+    SECTION("element lifetimes"){
+        int counter = 0;
+        {
+            inlined_vector<Counter, 4, true> v;
+            for (int i=0; i<10; i++) v.emplace_back(&counter);
+            CHECK(v.expanded());
+            CHECK(counter == 10);
+            v.pop_back();
+            CHECK(counter == 9);
+            inlined_vector<Counter, 4, true> v2 = v;
+            CHECK(counter == 18);
+            inlined_vector<Counter, 4, true> v3 = std::move(v2);
+            CHECK(counter == 18);
+            v3.clear();
+            CHECK(counter == 9);
+        }
+        CHECK(counter == 0);
+    }
 
-    v2 = v3;
-    CHECK_THAT(v2, Equals(v2, v3));
+    SECTION("push back an element of the vector while spilling"){
+        inlined_vector<std::string, 2, true> v { "first string that is not short", "second" };
+        v.push_back(v[0]);
+        v.insert(v.begin(), v[2]);
+        CHECK(v.expanded());
+        CHECK(v.size() == 4);
+        CHECK(v[0] == "first string that is not short");
+        CHECK(v[3] == "first string that is not short");
+    }
+}
 
-    v3 = v4;
-    CHECK_THAT(v3, Equals(v3, v4));
+// Shares a heap int but opts in to being moved with memcpy
+struct RelocatableOwner {
+    std::shared_ptr<int> value;
+    RelocatableOwner(int v = 0):value(std::make_shared<int>(v)){}
+};
+
+namespace bsp {
+template<> struct is_trivially_relocatable<RelocatableOwner> : std::true_type {};
 }
 
-using Clock = std::chrono::high_resolution_clock;
-struct Profile {
-    decltype(Clock::now()) start = Clock::now();
-    ~Profile(){
-        auto end = Clock::now();
-        std::cout << "- result: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() << "ns\n";
+TEST_CASE("trivially relocatable", "[inlined_vector]"){
+    static_assert(bsp::is_trivially_relocatable<int>::value, "int is trivially relocatable");
+    static_assert(!bsp::is_trivially_relocatable<std::string>::value, "std::string is not opted in");
+
+    inlined_vector<RelocatableOwner, 4, true> v;
+    for (int i=0; i<4; i++) v.emplace_back(i);
+    v.insert(v.begin(), RelocatableOwner{42});
+    CHECK(v.expanded());
+    v.erase(std::next(v.begin(), 2));
+    REQUIRE(v.size() == 4);
+    CHECK(*v[0].value == 42);
+    CHECK(*v[1].value == 0);
+    CHECK(*v[2].value == 2);
+    CHECK(*v[3].value == 3);
+
+    inlined_vector<RelocatableOwner, 4, true> v2 = std::move(v);
+    CHECK(v.empty());
+    CHECK(*v2.back().value == 3);
+
+    static_vector<RelocatableOwner, 4> s;
+    s.emplace_back(1);
+    s.emplace_back(2);
+    static_vector<RelocatableOwner, 4> s2 = std::move(s);
+    CHECK(s.size() == 0);
+    CHECK(*s2[1].value == 2);
+}
+
+struct SpillToFourTimesCapacity : bsp::inlined_vector_policy {
+    static std::size_t grow(std::size_t capacity, std::size_t required){
+        return std::max(required, 4 * capacity);
     }
 };
 
-TEST_CASE("benchmark", "[inlined_vector]"){
-    std::cout << "Performing basic benchmarks\n";
+TEST_CASE("capacity", "[inlined_vector]"){
+    SECTION("fixed"){
+        inlined_vector<int, 8, false> v;
+        CHECK(v.capacity() == 8);
+        v.reserve(8);
+        CHECK(v.capacity() == 8);
+    }
 
-    constexpr int ArraySize = 128;
-    constexpr int VecSize = 128;
+    SECTION("reserve inlined"){
+        inlined_vector<int, 8, true> v { 1, 2, 3 };
+        CHECK(v.capacity() == 8);
+        v.reserve(8);
+        CHECK(!v.expanded());
+        CHECK(v.capacity() == 8);
+    }
 
-    {
-        std::cout << "inlined_vector\n";
-        Profile profiler;        
+    SECTION("reserve beyond capacity"){
+        inlined_vector<std::string, 8, true> v { "a", "b", "c" };
+        v.reserve(100);
+        CHECK(v.expanded());
+        CHECK(v.capacity() == 100);
+        for (int i=0; i<97; i++) v.push_back("d");
+        CHECK(v.capacity() == 100);
+        CHECK(v[2] == "c");
+        v.reserve(10);
+        CHECK(v.capacity() == 100);
+    }
 
-        std::array<inlined_vector<int, VecSize, false>, ArraySize> vecs;
-        for (auto& vec: vecs){
-            for (int i=0; i<VecSize; i++){
-                vec.push_back(i);
-            }
+    SECTION("default growth spills to twice the capacity"){
+        inlined_vector<int, 8, true> v (8, 0);
+        v.push_back(1);
+        CHECK(v.capacity() == 16);
+        for (int i=0; i<8; i++) v.push_back(1);
+        CHECK(v.capacity() == 32);
+    }
+
+    SECTION("geometric growth"){
+        inlined_vector<int, 4, true, bsp::geometric_growth<3, 2>> v (4, 0);
+        v.push_back(1);
+        CHECK(v.capacity() == 6);
+        v.push_back(1);
+        v.push_back(1);
+        CHECK(v.capacity() == 9);
+    }
+
+    SECTION("custom growth"){
+        inlined_vector<int, 4, true, SpillToFourTimesCapacity> v (4, 0);
+        v.push_back(1);
+        CHECK(v.capacity() == 16);
+    }
+}
+
+template<typename T, bool Propagate>
+struct TrackingAllocator {
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::integral_constant<bool, Propagate>;
+    using propagate_on_container_copy_assignment = std::integral_constant<bool, Propagate>;
+    using propagate_on_container_swap = std::integral_constant<bool, Propagate>;
+    template<typename U> struct rebind { using other = TrackingAllocator<U, Propagate>; };
+
+    std::size_t* bytes = nullptr;
+
+    TrackingAllocator() = default;
+    explicit TrackingAllocator(std::size_t* bytes_) : bytes(bytes_) {}
+    template<typename U> TrackingAllocator(const TrackingAllocator<U, Propagate>& other) : bytes(other.bytes) {}
+
+    T* allocate(std::size_t n){
+        *bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* data, std::size_t n){
+        *bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(data, n);
+    }
+
+    bool operator==(const TrackingAllocator& other) const { return bytes == other.bytes; }
+    bool operator!=(const TrackingAllocator& other) const { return bytes != other.bytes; }
+};
+
+TEST_CASE("allocator", "[inlined_vector]"){
+    using Alloc = TrackingAllocator<int, false>;
+    using Vector = inlined_vector<int, 4, true, bsp::inlined_vector_policy, Alloc>;
+    std::size_t a_bytes = 0, b_bytes = 0;
+
+    SECTION("only spilled storage is allocated"){
+        {
+            Vector v { Alloc(&a_bytes) };
+            for (int i=0; i<4; i++) v.push_back(i);
+            CHECK(a_bytes == 0);
+            v.push_back(4);
+            CHECK(a_bytes == v.capacity() * sizeof(int));
+            CHECK(v.get_allocator() == Alloc(&a_bytes));
         }
+        CHECK(a_bytes == 0);
     }
 
-    {
-        std::cout << "inlined_vector forced to expand\n";
-        Profile profiler;
+    SECTION("move assignment steals from an equal allocator"){
+        Vector a { Alloc(&a_bytes) }, b { Alloc(&a_bytes) };
+        for (int i=0; i<10; i++) b.push_back(i);
+        const int* data = b.begin();
+        a = std::move(b);
+        CHECK(a.begin() == data);
+        CHECK(b.empty());
+    }
 
-        std::array<inlined_vector<int, VecSize/2, true>, ArraySize> vecs;
-        for (auto& vec: vecs){
-            for (int i=0; i<VecSize; i++){
-                vec.push_back(i);
-            }
+    SECTION("move assignment relocates into an unequal allocator"){
+        {
+            Vector a { Alloc(&a_bytes) }, b { Alloc(&b_bytes) };
+            for (int i=0; i<10; i++) b.push_back(i);
+            a = std::move(b);
+            CHECK(a.size() == 10);
+            CHECK(a[9] == 9);
+            CHECK(b.empty());
+            CHECK(a_bytes >= 10 * sizeof(int));
+            CHECK(a.get_allocator() == Alloc(&a_bytes));
         }
+        CHECK(a_bytes == 0);
+        CHECK(b_bytes == 0);
     }
 
-    {
-        std::cout << "std::vector\n";
-        Profile profiler;
+    SECTION("propagating allocator"){
+        using PAlloc = TrackingAllocator<int, true>;
+        using PVector = inlined_vector<int, 4, true, bsp::inlined_vector_policy, PAlloc>;
+        {
+            PVector a { PAlloc(&a_bytes) }, b { PAlloc(&b_bytes) };
+            for (int i=0; i<10; i++) b.push_back(i);
+            const int* data = b.begin();
+            a = std::move(b);
+            CHECK(a.begin() == data);
+            CHECK(a.get_allocator() == PAlloc(&b_bytes));
+
+            PVector c { PAlloc(&a_bytes) };
+            c = a;
+            CHECK(c.get_allocator() == PAlloc(&b_bytes));
+            CHECK(c[9] == 9);
+        }
+        CHECK(a_bytes == 0);
+        CHECK(b_bytes == 0);
+    }
 
-        std::array<std::vector<int>, ArraySize> vecs;
-        for (auto& vec: vecs){
-            for (int i=0; i<VecSize; i++){
-                vec.push_back(i);
-            }
+    SECTION("swap"){
+        Vector a { Alloc(&a_bytes) }, b { Alloc(&a_bytes) };
+        for (int i=0; i<10; i++) a.push_back(i);
+        b.push_back(42);
+        const int* data = a.begin();
+        swap(a, b);
+        CHECK(b.begin() == data);
+        CHECK(b.size() == 10);
+        CHECK(a.size() == 1);
+        CHECK(a[0] == 42);
+        b.swap(a);
+        CHECK(a.size() == 10);
+        CHECK(b[0] == 42);
+
+        inlined_vector<int, 4, false> c { 1, 2 }, d { 3 };
+        swap(c, d);
+        CHECK_THAT(c, Equals(c, std::vector<int> { 3 }));
+        CHECK_THAT(d, Equals(d, std::vector<int> { 1, 2 }));
+    }
+
+    SECTION("default allocator adds no size"){
+        CHECK(sizeof(inlined_vector<int, 4, true>) == sizeof(inlined_vector<int, 4, true, bsp::default_inlined_vector_policy, std::allocator<int>>));
+        CHECK(sizeof(Vector) > sizeof(inlined_vector<int, 4, true, bsp::inlined_vector_policy>));
+    }
+
+#ifdef BSP_INLINED_VECTOR_HAS_PMR
+    SECTION("pmr"){
+        std::array<std::uint8_t, 1024> buffer;
+        std::pmr::monotonic_buffer_resource resource (buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+        bsp::pmr::inlined_vector<int, 4> v (&resource);
+        for (int i=0; i<32; i++) v.push_back(i);
+        CHECK(v.expanded());
+        CHECK(reinterpret_cast<const std::uint8_t*>(v.begin()) >= buffer.data());
+        CHECK(reinterpret_cast<const std::uint8_t*>(v.end()) <= buffer.data() + buffer.size());
+        CHECK(v[31] == 31);
+    }
+#endif
+}
+
+struct alignas(64) CacheLineRecord {
+    int value = 0;
+    CacheLineRecord(int value = 0):value(value){}
+};
+
+template<std::size_t Alignment, class T> bool is_aligned(const T* p){
+    return reinterpret_cast<std::uintptr_t>(p) % Alignment == 0;
+}
+
+TEST_CASE("alignment", "[inlined_vector]"){
+    SECTION("over-aligned elements"){
+        inlined_vector<CacheLineRecord, 2, true> v;
+        v.emplace_back(1);
+        CHECK(is_aligned<64>(v.begin()));
+        for (int i=0; i<10; i++) v.emplace_back(i);
+        CHECK(v.expanded());
+        CHECK(is_aligned<64>(v.begin()));
+        CHECK(v[10].value == 9);
+    }
+
+    SECTION("forced buffer alignment"){
+        bsp::aligned_inlined_vector<float, 16, 64> fixed;
+        CHECK(is_aligned<64>(fixed.begin()));
+        CHECK(sizeof(fixed) % 64 == 0);
+
+        bsp::aligned_inlined_vector<float, 4, 64, true> v;
+        CHECK(is_aligned<64>(v.begin()));
+        for (int i=0; i<100; i++){
+            v.push_back(float(i));
+            CHECK(is_aligned<64>(v.begin()));
+        }
+        v.shrink_to_fit();
+        CHECK(is_aligned<64>(v.begin()));
+        v.erase(v.begin() + 2, v.end());
+        v.shrink_to_fit();
+        CHECK_FALSE(v.expanded());
+        CHECK(is_aligned<64>(v.begin()));
+    }
+
+    SECTION("array of aligned vectors"){
+        std::array<bsp::aligned_inlined_vector<float, 3, 32, true>, 4> vecs;
+        for (auto& v: vecs) CHECK(is_aligned<32>(v.begin()));
+    }
+
+    SECTION("aligned loads"){
+        bsp::aligned_inlined_vector<float, 8, 32, true> v;
+        for (int i=0; i<64; i++) v.push_back(float(i));
+        float sum = 0;
+#if defined(__AVX__)
+        __m256 acc = _mm256_setzero_ps();
+        for (std::size_t i=0; i<v.size(); i+=8) acc = _mm256_add_ps(acc, _mm256_load_ps(&v[i]));
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, acc);
+        for (float lane: lanes) sum += lane;
+#elif defined(__SSE__)
+        __m128 acc = _mm_setzero_ps();
+        for (std::size_t i=0; i<v.size(); i+=4) acc = _mm_add_ps(acc, _mm_load_ps(&v[i]));
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, acc);
+        for (float lane: lanes) sum += lane;
+#else
+        for (float value: v) sum += value;
+#endif
+        CHECK(sum == 2016.0f);
+    }
+
+    SECTION("custom allocator"){
+        using Alloc = TrackingAllocator<float, false>;
+        std::size_t bytes = 0;
+        {
+            inlined_vector<float, 4, true, bsp::inlined_vector_policy, Alloc, 16> v { Alloc(&bytes) };
+            for (int i=0; i<20; i++) v.push_back(float(i));
+            CHECK(is_aligned<16>(v.begin()));
+            CHECK(bytes > 0);
         }
+        CHECK(bytes == 0);
+    }
+}
+
+TEST_CASE("cache line layout", "[inlined_vector]"){
+    using Vector = bsp::cache_line_inlined_vector<int, 2>;
+    static_assert(bsp::cache_line_capacity<int, 2>::value == 30, "header plus 30 ints fill two lines");
+    static_assert(bsp::cache_line_capacity<double, 1>::value == 7, "header plus 7 doubles fill a line");
+    static_assert(sizeof(Vector) == 128, "vector doesn't fill two lines");
+    static_assert(alignof(Vector) == 64, "vector isn't line aligned");
+    static_assert(sizeof(bsp::cache_line_inlined_vector<char, 1>) == 64, "vector doesn't fill a line");
+
+    static_assert(sizeof(bsp::cache_line_inlined_vector<int, 2, bsp::capacity_profiler<>>) == 128, "profiled vector doesn't fill two lines");
+
+    // The capacity profiler's high water mark takes two ints from the buffer
+    constexpr int Capacity = Vector::inline_capacity;
+    std::array<Vector, 3> vecs;
+    for (auto& v: vecs){
+        const char* object = reinterpret_cast<const char*>(&v);
+        CHECK(reinterpret_cast<std::uintptr_t>(object) % 64 == 0);
+        CHECK(reinterpret_cast<const char*>(v.begin()) - object == 128 - Capacity * 4);
     }
+
+    Vector v;
+    for (int i=0; i<Capacity; i++) v.push_back(i);
+    CHECK_FALSE(v.expanded());
+    v.push_back(Capacity);
+    CHECK(v.expanded());
+    CHECK(v[Capacity] == Capacity);
+    v.erase(v.begin() + 4, v.end());
+    v.shrink_to_fit();
+    CHECK_FALSE(v.expanded());
+    CHECK_THAT(v, Equals(v, std::vector<int> { 0, 1, 2, 3 }));
+}
+
+TEST_CASE("pooled spill buffers", "[inlined_vector]"){
+    using Vector = bsp::pooled_inlined_vector<int, 4>;
+
+    SECTION("recycled within a size class"){
+        const int* data = nullptr;
+        {
+            Vector v;
+            for (int i=0; i<20; i++) v.push_back(i);
+            data = v.begin();
+        }
+        Vector v;
+        for (int i=0; i<20; i++) v.push_back(i);
+        CHECK(v.begin() == data);
+        CHECK(v[19] == 19);
+    }
+
+    SECTION("returned on shrink"){
+        Vector v;
+        for (int i=0; i<20; i++) v.push_back(i);
+        const int* data = v.begin();
+        v.erase(v.begin() + 2, v.end());
+        v.shrink_to_fit();
+        CHECK_FALSE(v.expanded());
+        Vector v2 { 1, 2, 3, 4, 5 };
+        v2.reserve(20);
+        CHECK(v2.begin() == data);
+    }
+
+    SECTION("large blocks bypass the pool"){
+        Vector v;
+        v.reserve(1 << 20);
+        for (int i=0; i<1000; i++) v.push_back(i);
+        CHECK(v[999] == 999);
+    }
+
+    SECTION("freed on another thread"){
+        bsp::pooled_allocator<int>::trim();
+        Vector v;
+        for (int i=0; i<20; i++) v.push_back(i);
+        const int* data = v.begin();
+        std::thread([&v]{ Vector().swap(v); }).join();
+        CHECK(v.empty());
+        Vector v2;
+        v2.reserve(20);
+        CHECK(v2.begin() == data);
+    }
+
+    SECTION("freed remotely before its thread exits"){
+        Vector v;
+        std::mutex m;
+        std::condition_variable cv;
+        bool freed = false;
+        std::thread owner([&]{
+            Vector local;
+            for (int i=0; i<20; i++) local.push_back(i);
+            std::unique_lock<std::mutex> lock(m);
+            v = std::move(local);
+            cv.notify_one();
+            cv.wait(lock, [&]{ return freed; });
+        });
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&]{ return v.size() == 20; });
+            v = Vector();
+            freed = true;
+            cv.notify_one();
+        }
+        owner.join();
+        CHECK(v.empty());
+    }
+
+    SECTION("outlives its thread"){
+        Vector v;
+        std::thread([&v]{
+            Vector local;
+            for (int i=0; i<20; i++) local.push_back(i);
+            v = std::move(local);
+        }).join();
+        REQUIRE(v.size() == 20);
+        CHECK(v[19] == 19);
+        v = Vector();
+        CHECK(v.empty());
+    }
+}
+
+TEST_CASE("arena spill", "[inlined_vector]"){
+    bsp::spill_arena arena (1024);
+    using Vector = bsp::arena_inlined_vector<int, 4>;
+
+    SECTION("spills into the arena"){
+        Vector v (arena);
+        for (int i=0; i<4; i++) v.push_back(i);
+        CHECK(arena.bytes_used() == 0);
+        v.push_back(4);
+        CHECK(v.expanded());
+        CHECK(arena.bytes_used() == v.capacity() * sizeof(int));
+        for (int i=5; i<100; i++) v.push_back(i);
+        CHECK(v[99] == 99);
+        CHECK(arena.bytes_used() >= v.capacity() * sizeof(int));
+    }
+
+    SECTION("larger than a chunk"){
+        Vector v (arena);
+        v.reserve(1000);
+        for (int i=0; i<1000; i++) v.push_back(i);
+        CHECK(v[999] == 999);
+    }
+
+    SECTION("reset reuses the chunks"){
+        const int* data = nullptr;
+        {
+            Vector v (arena);
+            for (int i=0; i<20; i++) v.push_back(i);
+            data = v.begin();
+        }
+        CHECK(arena.bytes_used() > 0);
+        arena.reset();
+        CHECK(arena.bytes_used() == 0);
+        Vector v (arena);
+        for (int i=0; i<20; i++) v.push_back(i);
+        CHECK(v.begin() == data);
+    }
+
+    SECTION("move and copy keep the arena"){
+        Vector v (arena);
+        for (int i=0; i<20; i++) v.push_back(i);
+        Vector moved = std::move(v);
+        CHECK(moved.get_allocator().arena == &arena);
+        Vector copy = moved;
+        CHECK(copy.get_allocator().arena == &arena);
+        CHECK_THAT(copy, Equals(copy, moved));
+    }
+
+    SECTION("element lifetimes"){
+        int counter = 0;
+        {
+            bsp::arena_inlined_vector<Counter, 2> v (arena);
+            for (int i=0; i<10; i++) v.emplace_back(&counter);
+            CHECK(counter == 10);
+        }
+        CHECK(counter == 0);
+    }
+}
+
+TEST_CASE("copy on write", "[inlined_vector]"){
+    using Vector = bsp::cow_inlined_vector<int, 4>;
+    auto contents = [](const Vector& v){ return std::vector<int>(v.begin(), v.end()); };
+
+    SECTION("inline copies are independent"){
+        Vector v { 1, 2, 3 };
+        Vector v2 (v);
+        CHECK_FALSE(v.shared());
+        v2[0] = 10;
+        CHECK(v[0] == 1);
+    }
+
+    SECTION("spilled copies share until written"){
+        Vector v { 1, 2, 3, 4, 5, 6 };
+        Vector v2 (v);
+        const Vector& cv = v;
+        const Vector& cv2 = v2;
+        CHECK(v.shared());
+        CHECK(v2.shared());
+        CHECK(cv.begin() == cv2.begin());
+        CHECK(cv2[5] == 6);
+        CHECK(cv.begin() == cv2.begin());
+
+        v2[0] = 10;
+        CHECK(cv.begin() != cv2.begin());
+        CHECK_FALSE(v.shared());
+        CHECK_FALSE(v2.shared());
+        CHECK(contents(v) == std::vector<int>({ 1, 2, 3, 4, 5, 6 }));
+        CHECK(contents(v2) == std::vector<int>({ 10, 2, 3, 4, 5, 6 }));
+    }
+
+    SECTION("mutations detach"){
+        Vector v { 1, 2, 3, 4, 5, 6 };
+        Vector a (v), b (v), c (v), d (v), e (v);
+        a.push_back(7);
+        b.insert(b.begin(), 0);
+        c.erase(c.begin());
+        d.pop_back();
+        e.resize(2);
+        CHECK_FALSE(v.shared());
+        CHECK(contents(a) == std::vector<int>({ 1, 2, 3, 4, 5, 6, 7 }));
+        CHECK(contents(b) == std::vector<int>({ 0, 1, 2, 3, 4, 5, 6 }));
+        CHECK(contents(c) == std::vector<int>({ 2, 3, 4, 5, 6 }));
+        CHECK(contents(d) == std::vector<int>({ 1, 2, 3, 4, 5 }));
+        CHECK(contents(e) == std::vector<int>({ 1, 2 }));
+        CHECK(contents(v) == std::vector<int>({ 1, 2, 3, 4, 5, 6 }));
+    }
+
+    SECTION("clear and shrink leave the other copies alone"){
+        Vector v { 1, 2, 3, 4, 5, 6 };
+        Vector v2 (v), v3 (v);
+        v2.clear();
+        CHECK(v2.empty());
+        v3.erase(v3.begin() + 2, v3.end());
+        v3.shrink_to_fit();
+        CHECK_FALSE(v3.expanded());
+        CHECK(contents(v3) == std::vector<int>({ 1, 2 }));
+        CHECK(contents(v) == std::vector<int>({ 1, 2, 3, 4, 5, 6 }));
+    }
+
+    SECTION("assignment shares"){
+        Vector v { 1, 2, 3, 4, 5, 6 };
+        Vector v2 { 1, 2, 3, 4, 5, 6, 7, 8 };
+        v2 = v;
+        CHECK(v.shared());
+        CHECK(contents(v2) == contents(v));
+        v2 = Vector { 1 };
+        CHECK_FALSE(v.shared());
+        CHECK(contents(v2) == std::vector<int>({ 1 }));
+    }
+
+    SECTION("element lifetimes"){
+        int count = 0;
+        {
+            bsp::cow_inlined_vector<Counter, 2> v;
+            for (int i=0; i<8; i++) v.emplace_back(&count);
+            auto v2 = v;
+            auto v3 = v;
+            CHECK(count == 8);
+            v2.emplace_back(&count);
+            CHECK(count == 17);
+            v3.clear();
+            CHECK(count == 17);
+        }
+        CHECK(count == 0);
+    }
+
+    SECTION("copies on other threads"){
+        Vector v;
+        for (int i=0; i<1000; i++) v.push_back(i);
+        std::vector<std::thread> threads;
+        std::vector<long long> sums (4);
+        for (int t=0; t<4; t++){
+            threads.emplace_back([v, t, &sums]() mutable {
+                const Vector& cv = v;
+                long long sum = 0;
+                for (int x: cv) sum += x;
+                v[0] = t;
+                sums[t] = sum + v[0];
+            });
+        }
+        for (auto& thread: threads) thread.join();
+        for (int t=0; t<4; t++) CHECK(sums[t] == 999 * 1000 / 2 + t);
+        CHECK_FALSE(v.shared());
+        CHECK(v[0] == 0);
+    }
+}
+
+TEST_CASE("segmented inlined_vector", "[segmented_inlined_vector]"){
+    using Vector = bsp::segmented_inlined_vector<int, 4>;
+
+    SECTION("spilling keeps the inline prefix in place"){
+        Vector v { 0, 1, 2, 3 };
+        const int* first = &v[0];
+        const int* fourth = &v[3];
+        CHECK_FALSE(v.expanded());
+        for (int i=4; i<100; i++) v.push_back(i);
+        CHECK(v.expanded());
+        CHECK(&v[0] == first);
+        CHECK(&v[3] == fourth);
+        for (int i=0; i<100; i++) CHECK(v[i] == i);
+        CHECK(v.back() == 99);
+        CHECK(v.segment_count() == 6);
+        CHECK(v.capacity() == 128);
+    }
+
+    SECTION("references into heap segments stay valid"){
+        Vector v;
+        for (int i=0; i<5; i++) v.push_back(i);
+        const int* fifth = &v[4];
+        for (int i=5; i<1000; i++) v.push_back(i);
+        CHECK(&v[4] == fifth);
+    }
+
+    SECTION("iteration"){
+        Vector v;
+        std::vector<int> expected;
+        for (int i=0; i<37; i++){
+            v.push_back(i);
+            expected.push_back(i);
+        }
+        CHECK(std::equal(v.begin(), v.end(), expected.begin()));
+        CHECK(std::distance(v.begin(), v.end()) == 37);
+
+        std::vector<int> reversed (expected.rbegin(), expected.rend());
+        using Reverse = std::reverse_iterator<Vector::const_iterator>;
+        const Vector& cv = v;
+        CHECK(std::equal(Reverse(cv.end()), Reverse(cv.begin()), reversed.begin()));
+
+        Vector empty;
+        CHECK(empty.begin() == empty.end());
+        Vector full { 0, 1, 2, 3 };
+        CHECK(std::distance(full.begin(), full.end()) == 4);
+    }
+
+    SECTION("for_each_segment"){
+        Vector v;
+        for (int i=0; i<20; i++) v.push_back(i);
+        std::vector<std::size_t> counts;
+        long long sum = 0;
+        v.for_each_segment([&](const int* data, std::size_t count){
+            counts.push_back(count);
+            for (std::size_t i=0; i<count; i++) sum += data[i];
+        });
+        CHECK_THAT(counts, Equals(counts, std::vector<std::size_t> { 4, 4, 8, 4 }));
+        CHECK(sum == 190);
+    }
+
+    SECTION("pop_back across segments"){
+        Vector v;
+        for (int i=0; i<13; i++) v.push_back(i);
+        for (int i=12; i>=3; i--){
+            CHECK(v.back() == i);
+            v.pop_back();
+        }
+        CHECK(v.size() == 3);
+        CHECK(v.segment_count() == 1);
+        for (int i=3; i<20; i++) v.push_back(i);
+        for (int i=0; i<20; i++) CHECK(v[i] == i);
+    }
+
+    SECTION("reserve and shrink_to_fit"){
+        Vector v;
+        v.reserve(100);
+        CHECK(v.capacity() == 128);
+        for (int i=0; i<10; i++) v.push_back(i);
+        v.shrink_to_fit();
+        CHECK(v.capacity() == 16);
+        CHECK(v[9] == 9);
+    }
+
+    SECTION("copy and move"){
+        Vector v;
+        for (int i=0; i<20; i++) v.push_back(i);
+        const int* tenth = &v[9];
+        Vector copy = v;
+        CHECK(std::equal(copy.begin(), copy.end(), v.begin()));
+        Vector moved = std::move(v);
+        CHECK(v.empty());
+        CHECK(&moved[9] == tenth);
+        CHECK(moved[3] == 3);
+        v = moved;
+        CHECK(v.size() == 20);
+        copy = std::move(moved);
+        CHECK(copy[19] == 19);
+        CHECK_THROWS(copy.at(20));
+    }
+
+    SECTION("element lifetimes"){
+        int counter = 0;
+        {
+            bsp::segmented_inlined_vector<Counter, 2> v;
+            for (int i=0; i<10; i++) v.emplace_back(&counter);
+            CHECK(counter == 10);
+            v.pop_back();
+            CHECK(counter == 9);
+            auto moved = std::move(v);
+            CHECK(counter == 9);
+            v = moved;
+            CHECK(counter == 18);
+            v.clear();
+            CHECK(counter == 9);
+        }
+        CHECK(counter == 0);
+    }
+}
+
+TEST_CASE("assignment", "[inlined_vector]"){
+    inlined_vector<int, 4, false> v1 { 1, 2, 3, 4 };
+    inlined_vector<int, 4, true> v2 { 1, 2, 4, 8 };
+    inlined_vector<int, 8, false> v3 { 0, 1, 0, 1, 0, 1, 0, 1};
+    inlined_vector<int, 8, true> v4 { 42, 42, 42, 42, 42, 42, 42, 42 };
+
+    v1 = v2;
+    CHECK_THAT(v1, Equals(v1, v2));
+
+    v2 = v3;
+    CHECK_THAT(v2, Equals(v2, v3));
+
+    v3 = v4;
+    CHECK_THAT(v3, Equals(v3, v4));
+}
+
+TEST_CASE("flat map", "[inlined_flat_map]"){
+    using Map = bsp::inlined_flat_map<int, std::string, 4, true>;
+    auto keys = [](const Map& m){
+        std::vector<int> result;
+        for (auto& entry: m) result.push_back(entry.first);
+        return result;
+    };
+
+    SECTION("insert keeps keys sorted and unique"){
+        Map m;
+        CHECK(m.insert({ 3, "c" }).second);
+        CHECK(m.insert({ 1, "a" }).second);
+        CHECK(m.insert({ 2, "b" }).second);
+        auto result = m.insert({ 2, "x" });
+        CHECK_FALSE(result.second);
+        CHECK(result.first->second == "b");
+        CHECK(keys(m) == std::vector<int>({ 1, 2, 3 }));
+        CHECK_FALSE(m.expanded());
+    }
+
+    SECTION("lookup"){
+        Map m { { 5, "e" }, { 1, "a" }, { 3, "c" } };
+        CHECK(m.find(3)->second == "c");
+        CHECK(m.find(4) == m.end());
+        CHECK(m.contains(5));
+        CHECK(m.count(2) == 0);
+        CHECK(m.lower_bound(2)->first == 3);
+        CHECK(m.upper_bound(3)->first == 5);
+        CHECK(m.upper_bound(5) == m.end());
+        CHECK(m.at(1) == "a");
+        CHECK_THROWS_AS(m.at(2), std::out_of_range);
+    }
+
+    SECTION("linear and binary search agree"){
+        for (int n: { 8, 16, 17, 100 }){
+            Map m;
+            for (int i=0; i<n; i++) m.emplace(i * 2, std::to_string(i));
+            CHECK(m.size() == static_cast<std::size_t>(n));
+            for (int i=0; i<n; i++){
+                CHECK(m.find(i * 2)->second == std::to_string(i));
+                CHECK(m.find(i * 2 + 1) == m.end());
+                CHECK(m.lower_bound(i * 2 + 1) == m.upper_bound(i * 2));
+            }
+        }
+    }
+
+    SECTION("operator[], try_emplace and insert_or_assign"){
+        Map m;
+        m[4] = "d";
+        m[2];
+        CHECK(m.size() == 2);
+        CHECK(m[2].empty());
+        CHECK_FALSE(m.try_emplace(4, "x").second);
+        CHECK(m[4] == "d");
+        CHECK_FALSE(m.insert_or_assign(4, "x").second);
+        CHECK(m[4] == "x");
+        CHECK(m.insert_or_assign(1, "a").second);
+        CHECK(keys(m) == std::vector<int>({ 1, 2, 4 }));
+    }
+
+    SECTION("erase"){
+        Map m { { 1, "a" }, { 2, "b" }, { 3, "c" }, { 4, "d" } };
+        CHECK(m.erase(2) == 1);
+        CHECK(m.erase(2) == 0);
+        m.erase(m.begin());
+        CHECK(keys(m) == std::vector<int>({ 3, 4 }));
+    }
+
+    SECTION("bulk insert merges once and keeps the first of equal keys"){
+        Map m { { 10, "ten" }, { 20, "twenty" } };
+        std::vector<std::pair<int, std::string>> entries;
+        for (int i=30; i>0; i-=5) entries.emplace_back(i, "new");
+        entries.emplace_back(5, "again");
+        m.insert(entries.begin(), entries.end());
+        CHECK(keys(m) == std::vector<int>({ 5, 10, 15, 20, 25, 30 }));
+        CHECK(m[5] == "new");
+        CHECK(m[10] == "ten");
+        CHECK(m.expanded());
+    }
+
+#ifdef BSP_INLINED_VECTOR_THROWS
+    SECTION("fixed capacity"){
+        bsp::inlined_flat_map<int, int, 2> fixed;
+        CHECK(fixed.insert({ 2, 2 }).second);
+        CHECK(fixed.insert({ 1, 1 }).second);
+        CHECK_FALSE(fixed.insert({ 1, 3 }).second);
+        CHECK_THROWS(fixed.insert({ 3, 3 }));
+        CHECK(fixed.size() == 2);
+        CHECK_THROWS(fixed[3] = 7);
+        CHECK(fixed.size() == 2);
+        CHECK(fixed.at(1) == 1);
+        CHECK(fixed.at(2) == 2);
+        CHECK_FALSE(fixed.contains(3));
+    }
+#endif
+}
+
+TEST_CASE("flat set", "[inlined_flat_set]"){
+    bsp::inlined_flat_set<int, 8> s { 4, 2, 8, 2, 6 };
+    CHECK(s.size() == 4);
+    CHECK(std::is_sorted(s.begin(), s.end()));
+    CHECK(s.contains(6));
+    CHECK_FALSE(s.contains(5));
+    CHECK(s.emplace(5).second);
+    CHECK_FALSE(s.insert(5).second);
+    CHECK(*s.lower_bound(7) == 8);
+    CHECK(s.erase(2) == 1);
+    CHECK(std::vector<int>(s.begin(), s.end()) == std::vector<int>({ 4, 5, 6, 8 }));
+
+    bsp::inlined_flat_set<int, 4, true, std::greater<int>> descending { 1, 3, 2, 5, 4 };
+    CHECK(std::vector<int>(descending.begin(), descending.end()) == std::vector<int>({ 5, 4, 3, 2, 1 }));
+    CHECK(descending.find(3) != descending.end());
+    CHECK(sizeof(descending) == sizeof(inlined_vector<int, 4, true>));
+
+    // Only the unique new keys count against a fixed capacity
+    bsp::inlined_flat_set<int, 4> fixed { 1, 2 };
+    fixed.insert({ 1, 2, 3, 3, 3 });
+    CHECK(std::vector<int>(fixed.begin(), fixed.end()) == std::vector<int>({ 1, 2, 3 }));
+    fixed.insert({ 0, 3, 0 });
+    CHECK(std::vector<int>(fixed.begin(), fixed.end()) == std::vector<int>({ 0, 1, 2, 3 }));
+    fixed.insert({ 2, 1, 3 });
+    CHECK(fixed.size() == 4);
+#ifdef BSP_INLINED_VECTOR_THROWS
+    CHECK_THROWS(fixed.insert({ 4, 4, 5 }));
+    CHECK(fixed.size() == 4);
+#endif
+}
+
+TEST_CASE("inlined string", "[inlined_string]"){
+    using String = bsp::inlined_string<16>;
+
+    SECTION("construction and termination"){
+        String empty;
+        CHECK(empty.empty());
+        CHECK(std::strcmp(empty.c_str(), "") == 0);
+        String s ("hello");
+        CHECK(s.size() == 5);
+        CHECK(std::strcmp(s.c_str(), "hello") == 0);
+        CHECK(String(3, 'x') == "xxx");
+        CHECK(String(std::string("from std")) == "from std");
+        CHECK(s.str() == std::string("hello"));
+        CHECK(s.capacity() == 16);
+    }
+
+    SECTION("append spills and stays terminated"){
+        String s ("identifier_");
+        s.append("with_a_long_suffix");
+        s += '!';
+        CHECK(s.expanded());
+        CHECK(s.size() == 30);
+        CHECK(std::strcmp(s.c_str(), "identifier_with_a_long_suffix!") == 0);
+        s.append(s);
+        CHECK(s.size() == 60);
+        CHECK(s.substr(30) == "identifier_with_a_long_suffix!");
+        s.append(s.c_str() + 4, 3);
+        CHECK(s.substr(60) == "tif");
+    }
+
+    SECTION("modifiers"){
+        String s ("abc");
+        s.push_back('d');
+        CHECK(s == "abcd");
+        s.pop_back();
+        s.pop_back();
+        CHECK(s == "ab");
+        CHECK(s.back() == 'b');
+        s.resize(4, 'z');
+        CHECK(s == "abzz");
+        s.resize(1);
+        CHECK(s == "a");
+        s.append(3, '-');
+        CHECK(s == "a---");
+        s.erase(1, 2);
+        CHECK(s == "a-");
+        s = s.c_str() + 1;
+        CHECK(s == "-");
+        s.clear();
+        CHECK(s.empty());
+        CHECK(s.c_str()[0] == '\0');
+        CHECK_THROWS_AS(s.substr(1), std::out_of_range);
+    }
+
+    SECTION("moves leave an empty string"){
+        String a ("a string that spills to the heap");
+        String b (std::move(a));
+        CHECK(a.empty());
+        CHECK(std::strcmp(a.c_str(), "") == 0);
+        a = std::move(b);
+        CHECK(b.empty());
+        CHECK(a == "a string that spills to the heap");
+    }
+
+    SECTION("find"){
+        String s ("the cat sat on the mat");
+        CHECK(s.find('c') == 4);
+        CHECK(s.find('t', 1) == 6);
+        CHECK(s.find('z') == String::npos);
+        CHECK(s.find("the") == 0);
+        CHECK(s.find("the", 1) == 15);
+        CHECK(s.find("mat") == 19);
+        CHECK(s.find("mats") == String::npos);
+        CHECK(s.find("") == 0);
+        CHECK(s.find(String("sat")) == 8);
+    }
+
+    SECTION("comparison"){
+        String a ("apple"), b ("apricot");
+        bsp::inlined_string<4> c ("apple");
+        CHECK(a == c);
+        CHECK(a != b);
+        CHECK(a < b);
+        CHECK(b > c);
+        CHECK(a <= c);
+        CHECK(a.compare("app") > 0);
+        CHECK(a.compare("apples") < 0);
+        CHECK("apple" == a);
+        std::ostringstream out;
+        out << a;
+        CHECK(out.str() == "apple");
+    }
+
+#ifdef BSP_INLINED_VECTOR_HAS_STRING_VIEW
+    SECTION("string_view"){
+        using namespace std::literals;
+        String s ("key"sv);
+        std::string_view view = s;
+        CHECK(view == "key");
+        s += "_suffix"sv;
+        CHECK(s.find("suf"sv) == 4);
+        CHECK(s.compare("key_suffix"sv) == 0);
+        CHECK(s == "key_suffix"sv);
+    }
+#endif
+}
+
+TEST_CASE("inlined bitvector", "[inlined_bitvector]"){
+    using Bits = bsp::inlined_bitvector<128, true>;
+
+    SECTION("packed storage"){
+        CHECK(sizeof(bsp::inlined_bitvector<64>) <= 3 * sizeof(std::uint64_t));
+        CHECK(sizeof(bsp::inlined_bitvector<128>) <= 4 * sizeof(std::uint64_t));
+    }
+
+    SECTION("set, test and count"){
+        Bits b (100);
+        CHECK(b.size() == 100);
+        CHECK(b.none());
+        b.set(0).set(63).set(64).set(99);
+        CHECK(b.test(63));
+        CHECK_FALSE(b[62]);
+        CHECK(b.count() == 4);
+        b.flip(99);
+        b.reset(0);
+        CHECK(b.count() == 2);
+        b.set();
+        CHECK(b.all());
+        CHECK(b.count() == 100);
+        b.flip();
+        CHECK(b.none());
+    }
+
+    SECTION("find_first and find_next"){
+        Bits b (200);
+        CHECK(b.find_first() == Bits::npos);
+        for (std::size_t i: { 3, 64, 65, 130, 199 }) b.set(i);
+        std::vector<std::size_t> found;
+        for (auto i = b.find_first(); i != Bits::npos; i = b.find_next(i)) found.push_back(i);
+        CHECK(found == std::vector<std::size_t>({ 3, 64, 65, 130, 199 }));
+        CHECK(b.expanded());
+    }
+
+    SECTION("push_back, pop_back and resize"){
+        Bits b;
+        for (int i=0; i<130; i++) b.push_back(i % 3 == 0);
+        CHECK(b.size() == 130);
+        CHECK(b.count() == 44);
+        b.pop_back();
+        b.pop_back();
+        CHECK(b.size() == 128);
+        CHECK(b.count() == 43);
+        b.resize(10);
+        CHECK(b.count() == 4);
+        b.resize(70, true);
+        CHECK(b.count() == 64);
+        CHECK(b.test(69));
+        CHECK_FALSE(b.test(8));
+    }
+
+    SECTION("bitwise operators"){
+        Bits a (70), b (70);
+        a.set(1).set(2).set(69);
+        b.set(2).set(3).set(69);
+        CHECK((a & b).count() == 2);
+        CHECK((a | b).count() == 4);
+        CHECK((a ^ b).count() == 2);
+        CHECK((~a).count() == 67);
+        CHECK_FALSE((~a).test(1));
+        Bits c (a);
+        c &= b;
+        c |= Bits(70).set(10);
+        c ^= a;
+        CHECK(c.count() == 2);
+        CHECK(c.test(1));
+        CHECK(c.test(10));
+        CHECK(c == Bits(70).set(1).set(10));
+        CHECK(c != a);
+    }
+
+    SECTION("operators with a shorter vector"){
+        Bits a (100, true), b (10, true);
+        a &= b;
+        CHECK(a.count() == 10);
+        b |= Bits(100, true);
+        CHECK(b.count() == 10);
+    }
+}
+
+TEST_CASE("inlined deque", "[inlined_deque]"){
+    auto contents = [](const bsp::inlined_deque<int, 4, true>& d){ return std::vector<int>(d.begin(), d.end()); };
+
+    SECTION("both ends"){
+        bsp::inlined_deque<int, 4, true> d;
+        d.push_back(2);
+        d.push_back(3);
+        d.push_front(1);
+        d.push_front(0);
+        CHECK(d.full());
+        CHECK_FALSE(d.expanded());
+        CHECK(d.front() == 0);
+        CHECK(d.back() == 3);
+        CHECK(contents(d) == std::vector<int>({ 0, 1, 2, 3 }));
+        d.pop_front();
+        d.pop_back();
+        CHECK(contents(d) == std::vector<int>({ 1, 2 }));
+        CHECK(d.at(1) == 2);
+        CHECK_THROWS_AS(d.at(2), std::out_of_range);
+    }
+
+    SECTION("wraps around as a queue"){
+        bsp::inlined_deque<int, 4, true> d;
+        int next = 0, expected = 0;
+        for (int i=0; i<100; i++){
+            d.push_back(next++);
+            if (d.size() == 3){
+                CHECK(d.front() == expected++);
+                d.pop_front();
+            }
+        }
+        CHECK_FALSE(d.expanded());
+        CHECK(contents(d) == std::vector<int>({ 98, 99 }));
+    }
+
+    SECTION("segments"){
+        bsp::inlined_deque<int, 4, true> d { 1, 2, 3 };
+        d.pop_front();
+        d.pop_front();
+        d.push_back(4);
+        d.push_back(5);
+        std::vector<std::size_t> runs;
+        std::vector<int> copied;
+        d.for_each_segment([&](const int* data, std::size_t count){
+            runs.push_back(count);
+            copied.insert(copied.end(), data, data + count);
+        });
+        CHECK(runs == std::vector<std::size_t>({ 2, 1 }));
+        CHECK(copied == std::vector<int>({ 3, 4, 5 }));
+    }
+
+    SECTION("spills to a heap ring"){
+        bsp::inlined_deque<int, 4, true> d { 2, 3 };
+        d.pop_front();
+        for (int i=4; i<10; i++) d.push_back(i);
+        d.push_front(d.back());
+        d.push_front(2);
+        CHECK(d.expanded());
+        CHECK(contents(d) == std::vector<int>({ 2, 9, 3, 4, 5, 6, 7, 8, 9 }));
+        d.push_back(d.front());
+        CHECK(d.back() == 2);
+        CHECK(d.capacity() >= d.size());
+    }
+
+    SECTION("element lifetimes"){
+        int count = 0;
+        {
+            bsp::inlined_deque<Counter, 2, true> d;
+            for (int i=0; i<5; i++) d.emplace_front(&count);
+            d.pop_back();
+            CHECK(count == 4);
+            auto copy = d;
+            CHECK(count == 8);
+            auto moved = std::move(copy);
+            CHECK(copy.empty());
+            CHECK(count == 8);
+            bsp::inlined_deque<Counter, 2, true> small;
+            small.emplace_back(&count);
+            moved = std::move(small);
+            CHECK(count == 5);
+            moved.clear();
+            CHECK(count == 4);
+        }
+        CHECK(count == 0);
+    }
+
+    SECTION("iterators"){
+        bsp::inlined_deque<int, 8> d;
+        for (int i=0; i<6; i++) d.push_front(i);
+        std::sort(d.begin(), d.end());
+        CHECK(std::is_sorted(d.cbegin(), d.cend()));
+        CHECK(d.end() - d.begin() == 6);
+        CHECK(*(d.begin() + 2) == 2);
+        CHECK(d.begin()[5] == 5);
+    }
+
+#ifdef BSP_INLINED_VECTOR_THROWS
+    SECTION("fixed capacity"){
+        bsp::inlined_deque<int, 2> d;
+        d.push_back(1);
+        d.push_front(0);
+        CHECK_THROWS(d.push_back(2));
+        CHECK_THROWS(d.push_front(2));
+        CHECK(d.size() == 2);
+    }
+#endif
+}
+
+TEST_CASE("inlined priority queue", "[inlined_priority_queue]"){
+    SECTION("pops in order"){
+        bsp::inlined_priority_queue<int, 32> q;
+        std::vector<int> values;
+        for (int i=0; i<32; i++) values.push_back((i * 13) % 32);
+        for (int v: values) q.push(v);
+        CHECK(q.full());
+        for (int expected=31; expected>=0; expected--){
+            REQUIRE(q.top() == expected);
+            q.pop();
+        }
+        CHECK(q.empty());
+    }
+
+    SECTION("replace_top"){
+        bsp::inlined_priority_queue<int, 8> q;
+        for (int v: { 5, 1, 9, 3 }) q.push(v);
+        q.replace_top(4);
+        CHECK(q.top() == 5);
+        CHECK(q.size() == 4);
+        q.replace_top(0);
+        CHECK(q.top() == 4);
+    }
+
+    SECTION("offer keeps the best K without spilling"){
+        bsp::inlined_priority_queue<int, 8, std::greater<int>, true> best;
+        std::mt19937 rng (7);
+        std::vector<int> all;
+        for (int i=0; i<1000; i++){
+            int v = static_cast<int>(rng() % 100000);
+            all.push_back(v);
+            best.offer(v);
+        }
+        CHECK(best.size() == 8);
+        CHECK_FALSE(best.elements().expanded());
+        std::sort(all.begin(), all.end(), std::greater<int>());
+        auto sorted = best.take_sorted();
+        CHECK(best.empty());
+        CHECK(std::vector<int>(sorted.begin(), sorted.end()) == std::vector<int>(all.begin(), all.begin() + 8));
+        CHECK(best.offer(-1));
+        CHECK(sizeof(best) == sizeof(best.elements()));
+    }
+
+    SECTION("move-only elements"){
+        bsp::inlined_priority_queue<std::unique_ptr<int>, 4, bool(*)(const std::unique_ptr<int>&, const std::unique_ptr<int>&)> q (
+            [](const std::unique_ptr<int>& a, const std::unique_ptr<int>& b){ return *a < *b; });
+        for (int v: { 2, 7, 1 }) q.push(std::unique_ptr<int>(new int(v)));
+        CHECK(*q.top() == 7);
+        q.pop();
+        CHECK(*q.top() == 2);
+    }
+
+#ifdef BSP_INLINED_VECTOR_THROWS
+    SECTION("fixed capacity"){
+        bsp::inlined_priority_queue<int, 2> q;
+        q.push(1);
+        q.push(2);
+        CHECK_THROWS(q.push(3));
+        CHECK(q.top() == 2);
+    }
+#endif
+}
+
+using Clock = std::chrono::high_resolution_clock;
+struct Profile {
+    decltype(Clock::now()) start = Clock::now();
+    ~Profile(){
+        auto end = Clock::now();
+        std::cout << "- result: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() << "ns\n";
+    }
+};
+
+TEST_CASE("benchmark", "[inlined_vector]"){
+    std::cout << "Performing basic benchmarks\n";
+
+    constexpr int ArraySize = 128;
+    constexpr int VecSize = 128;
+
+    {
+        std::cout << "inlined_vector\n";
+        Profile profiler;        
+
+        std::array<inlined_vector<int, VecSize, false>, ArraySize> vecs;
+        for (auto& vec: vecs){
+            for (int i=0; i<VecSize; i++){
+                vec.push_back(i);
+            }
+        }
+    }
+
+    {
+        std::cout << "inlined_vector unchecked\n";
+        Profile profiler;
+
+        std::array<inlined_vector<int, VecSize, false>, ArraySize> vecs;
+        for (auto& vec: vecs){
+            for (int i=0; i<VecSize; i++){
+                vec.push_back_unchecked(i);
+            }
+        }
+    }
+
+    {
+        std::cout << "inlined_vector forced to expand\n";
+        Profile profiler;
+
+        std::array<inlined_vector<int, VecSize/2, true>, ArraySize> vecs;
+        for (auto& vec: vecs){
+            for (int i=0; i<VecSize; i++){
+                vec.push_back(i);
+            }
+        }
+    }
+
+    {
+        std::cout << "pooled_inlined_vector forced to expand\n";
+        Profile profiler;
+
+        std::array<bsp::pooled_inlined_vector<int, VecSize/2>, ArraySize> vecs;
+        for (auto& vec: vecs){
+            for (int i=0; i<VecSize; i++){
+                vec.push_back(i);
+            }
+        }
+    }
+
+    {
+        std::cout << "std::vector\n";
+        Profile profiler;
+
+        std::array<std::vector<int>, ArraySize> vecs;
+        for (auto& vec: vecs){
+            for (int i=0; i<VecSize; i++){
+                vec.push_back(i);
+            }
+        }
+    }
+
+    {
+        std::cout << "inlined_vector element access\n";
+        std::array<inlined_vector<int, VecSize, true>, ArraySize> vecs;
+        for (auto& vec: vecs){
+            for (int i=0; i<VecSize; i++){
+                vec.push_back(i);
+            }
+        }
+
+        long long sum = 0;
+        {
+            Profile profiler;
+            for (auto& vec: vecs){
+                for (std::size_t i=0; i<vec.size(); i++){
+                    sum += vec[i] + vec.back();
+                }
+            }
+        }
+        CHECK(sum == ArraySize * ((VecSize * (VecSize - 1)) / 2 + VecSize * (VecSize - 1)));
+    }
+}
+
+// Not trivially copyable so inlined_vector takes the element-wise paths
+struct Wrapped {
+    int value = 0;
+    Wrapped(int value = 0):value(value){}
+    Wrapped(const Wrapped& other):value(other.value){}
+    Wrapped& operator=(const Wrapped& other){ value = other.value; return *this; }
+};
+
+struct RelocatableWrapped : Wrapped {
+    RelocatableWrapped(int value = 0):Wrapped(value){}
+};
+
+namespace bsp {
+template<> struct is_trivially_relocatable<RelocatableWrapped> : std::true_type {};
+}
+
+template<typename T, int N> void benchmark_relocation(const char* name){
+    constexpr int Repeats = 256;
+    std::cout << name << " (" << N << " elements)\n";
+    std::size_t total = 0;
+    {
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            inlined_vector<T, N, true> v;
+            for (int i=0; i<N; i++) v.push_back(T(i));
+            inlined_vector<T, N, true> copy = v;
+            copy.insert(copy.begin(), T(-1));
+            copy.erase(copy.begin());
+            inlined_vector<T, N, true> moved = std::move(copy);
+            total += moved.size();
+        }
+    }
+    CHECK(total == Repeats * N);
+}
+
+TEST_CASE("benchmark relocation", "[inlined_vector]"){
+    std::cout << "Benchmarking copy, insert, erase, spill and move\n";
+
+    benchmark_relocation<Wrapped, 16>("element-wise");
+    benchmark_relocation<RelocatableWrapped, 16>("opted in to relocation");
+    benchmark_relocation<int, 16>("trivially copyable");
+
+    benchmark_relocation<Wrapped, 64>("element-wise");
+    benchmark_relocation<RelocatableWrapped, 64>("opted in to relocation");
+    benchmark_relocation<int, 64>("trivially copyable");
+
+    benchmark_relocation<Wrapped, 256>("element-wise");
+    benchmark_relocation<RelocatableWrapped, 256>("opted in to relocation");
+    benchmark_relocation<int, 256>("trivially copyable");
+}
+
+TEST_CASE("benchmark bulk insertion", "[inlined_vector]"){
+    std::cout << "Benchmarking extending by 256 elements\n";
+
+    constexpr int Repeats = 256;
+    std::vector<int> source (256);
+    for (int i=0; i<256; i++) source[i] = i;
+
+    std::size_t total = 0;
+    {
+        std::cout << "push_back each element\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            inlined_vector<int, 64, true> v;
+            for (int value: source) v.push_back(value);
+            total += v.size();
+        }
+    }
+
+    {
+        std::cout << "extend\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            inlined_vector<int, 64, true> v;
+            v.extend(source);
+            total += v.size();
+        }
+    }
+    CHECK(total == 2 * Repeats * source.size());
+}
+
+template<class Vector> std::size_t benchmark_spill_cycles(const char* name){
+    constexpr int Repeats = 1024;
+    std::cout << name << "\n";
+    std::size_t total = 0;
+    Profile profiler;
+    for (int r=0; r<Repeats; r++){
+        Vector v;
+        for (int i=0; i<64; i++) v.push_back(i);
+        total += v.size();
+    }
+    return total;
+}
+
+TEST_CASE("benchmark spill recycling", "[inlined_vector]"){
+    std::cout << "Benchmarking repeatedly spilling to 64 elements\n";
+
+    auto total = benchmark_spill_cycles<inlined_vector<int, 16, true>>("inlined_vector forced to expand");
+    total += benchmark_spill_cycles<bsp::pooled_inlined_vector<int, 16>>("pooled_inlined_vector forced to expand");
+    CHECK(total == 2 * 1024 * 64);
+}
+
+TEST_CASE("benchmark arena spill", "[inlined_vector]"){
+    std::cout << "Benchmarking 64 scratch vectors per frame spilling to 64 elements\n";
+
+    constexpr int Frames = 64;
+    constexpr int VectorsPerFrame = 64;
+    std::size_t total = 0;
+    {
+        std::cout << "heap spill\n";
+        Profile profiler;
+        for (int f=0; f<Frames; f++){
+            for (int n=0; n<VectorsPerFrame; n++){
+                inlined_vector<int, 16, true> v;
+                for (int i=0; i<64; i++) v.push_back(i);
+                total += v.size();
+            }
+        }
+    }
+
+    {
+        std::cout << "arena spill\n";
+        bsp::spill_arena arena;
+        Profile profiler;
+        for (int f=0; f<Frames; f++){
+            for (int n=0; n<VectorsPerFrame; n++){
+                bsp::arena_inlined_vector<int, 16> v (arena);
+                for (int i=0; i<64; i++) v.push_back(i);
+                total += v.size();
+            }
+            arena.reset();
+        }
+    }
+    CHECK(total == 2 * Frames * VectorsPerFrame * 64);
+}
+
+TEST_CASE("benchmark segmented spill", "[segmented_inlined_vector]"){
+    std::cout << "Benchmarking spilling from 64 to 256 elements and summing\n";
+
+    constexpr int Repeats = 256;
+    long long total = 0;
+    {
+        std::cout << "inlined_vector\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            inlined_vector<int, 64, true> v;
+            for (int i=0; i<256; i++) v.push_back(i);
+            for (int value: v) total += value;
+        }
+    }
+
+    {
+        std::cout << "segmented_inlined_vector\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            bsp::segmented_inlined_vector<int, 64> v;
+            for (int i=0; i<256; i++) v.push_back(i);
+            v.for_each_segment([&](const int* data, std::size_t count){
+                for (std::size_t i=0; i<count; i++) total += data[i];
+            });
+        }
+    }
+    CHECK(total == 2LL * Repeats * (255 * 256 / 2));
+}
+
+TEST_CASE("benchmark cache line layout", "[inlined_vector]"){
+    std::cout << "Benchmarking reading the size and first element of 4096 vectors\n";
+
+    constexpr int ArraySize = 4096;
+    constexpr int Repeats = 16;
+    long long sum = 0;
+    {
+        std::cout << "inlined_vector (size after the buffer)\n";
+        // Static storage keeps the arrays off the stack and honours alignment
+        static std::array<inlined_vector<int, 30, true>, ArraySize> vecs;
+        for (auto& vec: vecs) vec.push_back(1);
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            for (auto& vec: vecs){
+                if (!vec.empty()) sum += vec.front();
+            }
+        }
+    }
+
+    {
+        std::cout << "cache_line_inlined_vector (size first)\n";
+        using Vector = bsp::cache_line_inlined_vector<int, 2>;
+        static std::array<Vector, ArraySize> vecs;
+        for (auto& vec: vecs) vec.push_back(1);
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            for (auto& vec: vecs){
+                if (!vec.empty()) sum += vec.front();
+            }
+        }
+    }
+    CHECK(sum == 2LL * Repeats * ArraySize);
+}
+
+TEST_CASE("benchmark resize", "[inlined_vector]"){
+    std::cout << "Benchmarking resizing a byte buffer to 4 KiB and filling it\n";
+
+    constexpr int Repeats = 1024;
+    std::size_t total = 0;
+    {
+        std::cout << "resize\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            inlined_vector<std::uint8_t, 4096, false> v;
+            v.resize(4096);
+            std::memset(v.begin(), r & 0xff, v.size());
+            total += v[r % 4096];
+        }
+    }
+
+    {
+        std::cout << "resize_default_init\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            inlined_vector<std::uint8_t, 4096, false> v;
+            v.resize_default_init(4096);
+            std::memset(v.begin(), r & 0xff, v.size());
+            total += v[r % 4096];
+        }
+    }
+    CHECK(total == 2 * ((Repeats / 256) * (255 * 256 / 2)));
+}
+
+TEST_CASE("benchmark copy on write", "[inlined_vector]"){
+    std::cout << "Benchmarking read-only copies of a spilled vector of 1024 ints\n";
+
+    constexpr int Repeats = 10000;
+    long long total = 0;
+    {
+        std::cout << "inlined_vector\n";
+        inlined_vector<int, 16, true> v;
+        for (int i=0; i<1024; i++) v.push_back(i);
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            const inlined_vector<int, 16, true> copy (v);
+            total += copy[r % 1024];
+        }
+    }
+
+    {
+        std::cout << "cow_inlined_vector\n";
+        bsp::cow_inlined_vector<int, 16> v;
+        for (int i=0; i<1024; i++) v.push_back(i);
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            const bsp::cow_inlined_vector<int, 16> copy (v);
+            total += copy[r % 1024];
+        }
+    }
+    CHECK(total > 0);
+}
+
+template<class Map> std::size_t benchmark_map_lookups(const char* name, int size, int repeats){
+    std::cout << name << "\n";
+    std::size_t found = 0;
+    Profile profiler;
+    for (int r=0; r<repeats; r++){
+        Map m;
+        for (int i=0; i<size; i++) m[(i * 7919) % size * 2] = i;
+        for (int i=0; i<size * 2; i++) found += m.count(i);
+    }
+    return found;
+}
+
+TEST_CASE("benchmark flat map", "[inlined_flat_map]"){
+    for (int size: { 4, 16, 64, 256 }){
+        std::cout << "Benchmarking building a map of " << size << " ints and looking up " << size * 2 << " keys\n";
+        const int repeats = 64 * 1024 / size;
+        const std::size_t expected = static_cast<std::size_t>(size) * repeats;
+        CHECK(benchmark_map_lookups<bsp::inlined_flat_map<int, int, 16, true>>("inlined_flat_map", size, repeats) == expected);
+        CHECK(benchmark_map_lookups<std::map<int, int>>("std::map", size, repeats) == expected);
+        CHECK(benchmark_map_lookups<std::unordered_map<int, int>>("std::unordered_map", size, repeats) == expected);
+    }
+}
+
+TEST_CASE("benchmark inlined string", "[inlined_string]"){
+    constexpr int Repeats = 20000;
+    const char* source = "an_identifier_string_long_enough_for_the_largest_benchmark_size!";
+    for (std::size_t length: { 8, 16, 32, 64 }){
+        std::cout << "Benchmarking building and searching a " << length << " byte string\n";
+        std::size_t total = 0;
+        {
+            std::cout << "inlined_string<40>\n";
+            Profile profiler;
+            for (int r=0; r<Repeats; r++){
+                bsp::inlined_string<40> s (source, length / 2);
+                s.append(source + length / 2, length - length / 2);
+                total += s.find('_') + (s == source ? 1 : 0) + s.size();
+            }
+        }
+        {
+            std::cout << "std::string\n";
+            Profile profiler;
+            for (int r=0; r<Repeats; r++){
+                std::string s (source, length / 2);
+                s.append(source + length / 2, length - length / 2);
+                total += s.find('_') + (s == source ? 1 : 0) + s.size();
+            }
+        }
+        CHECK(total == 2 * Repeats * (2 + length + (length == 64 ? 1 : 0)));
+    }
+}
+
+
+TEST_CASE("benchmark inlined bitvector", "[inlined_bitvector]"){
+    std::cout << "Benchmarking counting and walking 128 flags\n";
+
+    constexpr int Repeats = 100000;
+    std::size_t total = 0;
+    {
+        std::cout << "inlined_vector<bool, 128>\n";
+        inlined_vector<bool, 128, false> flags (128);
+        for (int i=0; i<128; i+=5) flags[i] = true;
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            flags[r % 128] = !flags[r % 128];
+            total += static_cast<std::size_t>(std::count(flags.begin(), flags.end(), true));
+            for (int i=0; i<128; i++) if (flags[i]) { total += i; break; }
+        }
+    }
+
+    {
+        std::cout << "inlined_bitvector<128>\n";
+        bsp::inlined_bitvector<128> flags (128);
+        for (int i=0; i<128; i+=5) flags.set(i);
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            flags.flip(r % 128);
+            total += flags.count();
+            total += flags.find_first();
+        }
+    }
+    CHECK(total > 0);
+}
+
+
+TEST_CASE("benchmark inlined deque", "[inlined_deque]"){
+    std::cout << "Benchmarking a work queue holding up to 16 ints\n";
+
+    constexpr int Repeats = 20000;
+    long long total = 0;
+    {
+        std::cout << "inlined_vector with erase(begin())\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            inlined_vector<int, 16, false> queue;
+            for (int i=0; i<64; i++){
+                queue.push_back(i);
+                if (queue.full()) { total += queue.front(); queue.erase(queue.begin()); }
+            }
+        }
+    }
+
+    {
+        std::cout << "inlined_deque\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            bsp::inlined_deque<int, 16> queue;
+            for (int i=0; i<64; i++){
+                queue.push_back(i);
+                if (queue.full()) { total += queue.front(); queue.pop_front(); }
+            }
+        }
+    }
+
+    {
+        std::cout << "std::deque\n";
+        Profile profiler;
+        for (int r=0; r<Repeats; r++){
+            std::deque<int> queue;
+            for (int i=0; i<64; i++){
+                queue.push_back(i);
+                if (queue.size() == 16) { total += queue.front(); queue.pop_front(); }
+            }
+        }
+    }
+    CHECK(total == 3LL * Repeats * (48 * 49 / 2));
+}
+
+
+template<int K> void benchmark_top_k(const std::vector<float>& scores, int queries){
+    constexpr int Candidates = 512;
+    float sorted_total = 0, std_total = 0, inlined_total = 0;
+    {
+        std::cout << "sort and truncate\n";
+        Profile profiler;
+        for (int q=0; q<queries; q++){
+            inlined_vector<float, Candidates, false> all;
+            all.assign(scores.begin() + q, scores.begin() + q + Candidates);
+            std::sort(all.begin(), all.end(), std::greater<float>());
+            all.resize(K);
+            sorted_total += all.back();
+        }
+    }
+
+    {
+        std::cout << "std::priority_queue\n";
+        Profile profiler;
+        for (int q=0; q<queries; q++){
+            std::priority_queue<float, std::vector<float>, std::greater<float>> best;
+            for (int i=0; i<Candidates; i++){
+                const float score = scores[q + i];
+                if (best.size() < K) best.push(score);
+                else if (score > best.top()) { best.pop(); best.push(score); }
+            }
+            std_total += best.top();
+        }
+    }
+
+    {
+        std::cout << "inlined_priority_queue\n";
+        Profile profiler;
+        for (int q=0; q<queries; q++){
+            bsp::inlined_priority_queue<float, K, std::greater<float>> best;
+            for (int i=0; i<Candidates; i++) best.offer(scores[q + i]);
+            inlined_total += best.top();
+        }
+    }
+    CHECK(sorted_total == std_total);
+    CHECK(inlined_total == std_total);
+}
+
+TEST_CASE("benchmark inlined priority queue", "[inlined_priority_queue]"){
+    constexpr int Queries = 2000;
+    std::mt19937 rng (11);
+    std::uniform_real_distribution<float> uniform (0, 1);
+    std::vector<float> scores;
+    for (int i=0; i<Queries + 512; i++) scores.push_back(uniform(rng));
+
+    std::cout << "Benchmarking keeping the best 8 of 512 candidates\n";
+    benchmark_top_k<8>(scores, Queries);
+    std::cout << "Benchmarking keeping the best 32 of 512 candidates\n";
+    benchmark_top_k<32>(scores, Queries);
+    std::cout << "Benchmarking keeping the best 64 of 512 candidates\n";
+    benchmark_top_k<64>(scores, Queries);
 }